@@ -0,0 +1,179 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Allocator calls of every sb_tree operation, counted through the Allocator
+// template argument with counting_allocator. Operations on single elements
+// are reported per call; the whole-container operations (copy, assignment,
+// move, swap, clear, construction and destruction) run once on a tree of
+// the given size.
+//
+// usage: allocation_benchmark [size] [container filter]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+#include "../sb_tree.h"
+#include "counting_allocator.h"
+
+using allocator_type = counting_allocator<uint64_t>;
+
+// keeps the results from being optimized away
+static uint64_t sink = 0;
+
+template <class F>
+static allocation_counts measure(F&& f)
+{
+	allocation_counts before = allocator_type::counts();
+	f();
+	return allocator_type::counts() - before;
+}
+
+static void report(const char* name, const char* op, size_t calls, const allocation_counts& c)
+{
+	double d = calls ? static_cast<double>(calls) : 1.0;
+	std::printf("%-14s %-28s %10zu %12.3f %12.3f %12.1f\n",
+		name, op, calls, c.allocations / d, c.deallocations / d, c.bytes_allocated / d);
+}
+
+template <class Tree>
+static void run(const char* name, size_t n)
+{
+	// even keys are in the tree, odd keys are not
+	std::vector<uint64_t> keys(n);
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = 2 * i;
+	std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+
+	alignas(Tree) unsigned char storage[sizeof(Tree)];
+	Tree* p = nullptr;
+	report(name, "construction", 1, measure([&] { p = new (storage) Tree(); }));
+	report(name, "destruction (empty)", 1, measure([&] { p->~Tree(); }));
+
+	Tree t;
+	report(name, "insert_equal", n, measure([&] {
+		for (uint64_t k : keys)
+			t.insert_equal(k);
+	}));
+	Tree u;
+	report(name, "insert_unique (new key)", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += u.insert_unique(k).second;
+	}));
+	report(name, "insert_unique (existing key)", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += u.insert_unique(k).second;
+	}));
+	report(name, "emplace_unique (existing key)", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += u.emplace_unique(k).second;
+	}));
+	report(name, "insert_unique hint (existing)", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += *u.insert_unique(u.cend(), k);
+	}));
+	report(name, "find", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += u.find(k + 1) == u.end();
+	}));
+	report(name, "lower_bound", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += *u.lower_bound(k);
+	}));
+	report(name, "rank", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += u.rank(k);
+	}));
+	report(name, "select", n, measure([&] {
+		for (size_t i = 0; i < n; ++i)
+			sink += *u.select(i);
+	}));
+
+	Tree* c = nullptr;
+	alignas(Tree) unsigned char copy_storage[sizeof(Tree)];
+	report(name, "copy construction", 1, measure([&] { c = new (copy_storage) Tree(t); }));
+	report(name, "copy assignment", 1, measure([&] { *c = u; }));
+	Tree m;
+	report(name, "move construction", 1, measure([&] { new (storage) Tree(std::move(*c)); }));
+	p = reinterpret_cast<Tree*>(storage);
+	report(name, "move assignment", 1, measure([&] { m = std::move(*p); }));
+	report(name, "swap", 1, measure([&] { m.swap(t); }));
+	report(name, "erase (key)", n, measure([&] {
+		for (uint64_t k : keys)
+			sink += m.erase(k);
+	}));
+	report(name, "erase (iterator)", n, measure([&] {
+		while (!t.empty())
+			t.erase(t.begin());
+	}));
+	report(name, "clear", 1, measure([&] { u.clear(); }));
+	report(name, "destruction (moved-from)", 1, measure([&] { c->~Tree(); }));
+	p->~Tree();
+}
+
+using size_tree   = sb_tree<uint64_t, std::less<uint64_t>, allocator_type>;
+using weight_tree = sb_tree<uint64_t, std::less<uint64_t>, allocator_type,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_weight_balance<>>;
+using treap_tree  = sb_tree<uint64_t, std::less<uint64_t>, allocator_type,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_treap_balance>;
+using splay_tree  = sb_tree<uint64_t, std::less<uint64_t>, allocator_type,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_splay_balance>;
+
+int main(int argc, char* argv[])
+{
+	size_t n = argc > 1 ? static_cast<size_t>(std::atof(argv[1])) : 100000;
+	const char* filter = argc > 2 ? argv[2] : "";
+
+	struct entry
+	{
+		const char* name;
+		void        (*run)(const char*, size_t);
+	};
+	const entry containers[] = {
+		{ "sb_tree",        run<size_tree> },
+		{ "sb_tree/weight", run<weight_tree> },
+		{ "sb_tree/treap",  run<treap_tree> },
+		{ "sb_tree/splay",  run<splay_tree> },
+	};
+
+	std::printf("%-14s %-28s %10s %12s %12s %12s\n",
+		"container", "operation", "calls", "allocs/call", "frees/call", "bytes/call");
+	for (const entry& e : containers)
+		if (std::strstr(e.name, filter))
+			e.run(e.name, n);
+	allocation_counts total = allocator_type::counts();
+	if (total.allocations != total.deallocations || total.bytes_allocated != total.bytes_deallocated)
+		std::printf("leaked %zu allocations, %zu bytes\n",
+			total.allocations - total.deallocations, total.bytes_allocated - total.bytes_deallocated);
+	std::fprintf(stderr, "%llu\n", static_cast<unsigned long long>(sink & 1));
+	return 0;
+}
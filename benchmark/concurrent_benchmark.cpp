@@ -0,0 +1,466 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Multi-threaded scalability of the concurrent access modes: a sb_tree
+// behind a mutex, a sb_tree behind a shared_mutex, concurrent_sb_tree,
+// sharded_sb_tree and rcu_sb_tree, from 1 to N threads. Each thread is
+// pinned to its own allowed CPU, in order, and times every operation with
+// sb_tree_latency_clock. The report gives the throughput, the scaling
+// efficiency against one thread of the same mode, the percentiles of all the
+// operations and the lowest and highest p99 among the threads.
+//
+// usage: concurrent_benchmark [--no-pin] [threads] [read percent] [operations per thread] [mode filter]
+//
+// The writes are insertions and erasures in equal parts. rcu_sb_tree takes
+// one writer at a time, so its writers share a mutex and its readers do not.
+// concurrent_sb_tree runs with batches of 1, where the latency of a write
+// covers its application, and as concurrent/256 with batches of 256, where
+// most writes are only enqueued and the last one of each batch applies it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "../concurrent_sb_tree.h"
+#include "../rcu_sb_tree.h"
+#include "../sharded_sb_tree.h"
+#include "../sb_tree_latency.h"
+
+using tree_type = sb_tree<uint64_t>;
+
+// keeps the lookups from being optimized away
+static std::atomic<uint64_t> sink(0);
+
+// Access modes. Every reading thread goes through a reader handle, which
+// only rcu_sb_tree needs.
+
+struct no_reader
+{};
+
+// The plain approach: every operation takes the same mutex.
+class mutex_sb_tree
+{
+public:
+	using reader = no_reader;
+
+	reader make_reader(void)
+	{
+		return reader();
+	}
+
+	void insert_equal(uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tree.insert_equal(value);
+	}
+
+	void erase(uint64_t key)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tree.erase(key);
+	}
+
+	bool find(reader&, uint64_t key, uint64_t& value) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto itr = tree.find(key);
+		if (itr == tree.end())
+			return false;
+		value = *itr;
+		return true;
+	}
+
+	void flush(void)
+	{}
+
+private:
+	mutable std::mutex mutex;
+	tree_type          tree;
+};
+
+// Readers share the lock, writers take it exclusively.
+class shared_mutex_sb_tree
+{
+public:
+	using reader = no_reader;
+
+	reader make_reader(void)
+	{
+		return reader();
+	}
+
+	void insert_equal(uint64_t value)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		tree.insert_equal(value);
+	}
+
+	void erase(uint64_t key)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		tree.erase(key);
+	}
+
+	bool find(reader&, uint64_t key, uint64_t& value) const
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto itr = tree.find(key);
+		if (itr == tree.end())
+			return false;
+		value = *itr;
+		return true;
+	}
+
+	void flush(void)
+	{}
+
+private:
+	mutable std::shared_mutex mutex;
+	tree_type                 tree;
+};
+
+// With a batch of 1 every write is applied before it returns. With larger
+// batches a write only enqueues its command, except the one that fills the
+// batch and applies it, so the percentiles mix both costs.
+template <size_t BatchCapacity>
+class concurrent_mode
+{
+public:
+	using reader = no_reader;
+
+	concurrent_mode(void)
+		: tree(BatchCapacity)
+	{}
+
+	reader make_reader(void)
+	{
+		return reader();
+	}
+
+	void insert_equal(uint64_t value)
+	{
+		tree.insert_equal(value);
+	}
+
+	void erase(uint64_t key)
+	{
+		tree.erase(key);
+	}
+
+	bool find(reader&, uint64_t key, uint64_t& value) const
+	{
+		return tree.find(key, value);
+	}
+
+	void flush(void)
+	{
+		tree.flush();
+	}
+
+private:
+	concurrent_sb_tree<tree_type> tree;
+};
+
+class sharded_mode
+{
+public:
+	using reader = no_reader;
+
+	reader make_reader(void)
+	{
+		return reader();
+	}
+
+	void insert_equal(uint64_t value)
+	{
+		tree.insert_equal(value);
+	}
+
+	void erase(uint64_t key)
+	{
+		tree.erase(key);
+	}
+
+	bool find(reader&, uint64_t key, uint64_t& value) const
+	{
+		return tree.find(key, value);
+	}
+
+	void flush(void)
+	{}
+
+private:
+	sharded_sb_tree<tree_type> tree;
+};
+
+class rcu_mode
+{
+public:
+	using reader = rcu_sb_tree<uint64_t>::reader;
+
+	explicit rcu_mode(unsigned threads)
+		: tree(threads + 1)
+	{}
+
+	reader make_reader(void)
+	{
+		return tree.make_reader();
+	}
+
+	void insert_equal(uint64_t value)
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		tree.insert_equal(value);
+	}
+
+	void erase(uint64_t key)
+	{
+		std::lock_guard<std::mutex> lock(writer);
+		tree.erase(key);
+	}
+
+	bool find(reader& r, uint64_t key, uint64_t& value) const
+	{
+		return r.find(key, value);
+	}
+
+	void flush(void)
+	{}
+
+private:
+	std::mutex            writer;
+	rcu_sb_tree<uint64_t> tree;
+};
+
+// measurement
+
+struct result
+{
+	double   mops;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t min_thread_p99;
+	uint64_t max_thread_p99;
+};
+
+// the CPUs this process may run on, in order
+static std::vector<int> allowed_cpus(void)
+{
+	std::vector<int> cpus;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (!sched_getaffinity(0, sizeof(set), &set))
+		for (int i = 0; i < CPU_SETSIZE; ++i)
+			if (CPU_ISSET(i, &set))
+				cpus.push_back(i);
+#endif
+	return cpus;
+}
+
+static void pin_thread(std::thread& t, int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+#else
+	(void)t;
+	(void)cpu;
+#endif
+}
+
+template <class Container>
+static result run(Container& container, unsigned threads, unsigned read_percent, size_t operations,
+	uint64_t key_range, const std::vector<int>& cpus)
+{
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> start(false);
+	std::vector<std::unique_ptr<sb_tree_latency_histogram>> latency;
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < threads; ++i)
+		latency.emplace_back(new sb_tree_latency_histogram());
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		workers.emplace_back([&, i] {
+			sb_tree_latency_histogram& h = *latency[i];
+			typename Container::reader r = container.make_reader();
+			std::mt19937_64 rng(i + 1);
+			uint64_t value, found = 0;
+			++ready;
+			while (!start.load())
+				std::this_thread::yield();
+			for (size_t n = 0; n < operations; ++n)
+			{
+				uint64_t key = rng() % key_range;
+				unsigned dice = static_cast<unsigned>(rng() % 100);
+				uint64_t begin = sb_tree_latency_clock::now();
+				if (dice < read_percent)
+					found += container.find(r, key, value);
+				else if (dice & 1)
+					container.insert_equal(key);
+				else
+					container.erase(key);
+				h.record(sb_tree_latency_clock::now() - begin);
+			}
+			sink += found;
+		});
+		if (!cpus.empty())
+			pin_thread(workers.back(), cpus[i % cpus.size()]);
+	}
+	while (ready.load() != threads)
+		std::this_thread::yield();
+	auto first = std::chrono::steady_clock::now();
+	start.store(true);
+	for (auto& worker : workers)
+		worker.join();
+	container.flush();
+	auto last = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(last - first).count();
+
+	double ns = sb_tree_latency_clock::ns_per_tick();
+	sb_tree_latency_histogram all;
+	result res;
+	res.mops = threads * operations / seconds / 1e6;
+	res.min_thread_p99 = ~uint64_t(0);
+	res.max_thread_p99 = 0;
+	for (auto& h : latency)
+	{
+		all.merge(*h);
+		uint64_t p99 = static_cast<uint64_t>(h->percentile(0.99) * ns);
+		res.min_thread_p99 = std::min(res.min_thread_p99, p99);
+		res.max_thread_p99 = std::max(res.max_thread_p99, p99);
+	}
+	res.p50 = static_cast<uint64_t>(all.percentile(0.5) * ns);
+	res.p99 = static_cast<uint64_t>(all.percentile(0.99) * ns);
+	res.p999 = static_cast<uint64_t>(all.percentile(0.999) * ns);
+	return res;
+}
+
+template <class Container>
+static void prefill(Container& container, uint64_t key_range)
+{
+	for (uint64_t key = 0; key < key_range; key += 2)
+		container.insert_equal(key);
+	container.flush();
+}
+
+// rcu_mode sizes its reader slots by the number of threads
+template <class Container>
+static result measure(unsigned threads, unsigned read_percent, size_t operations, uint64_t key_range,
+	const std::vector<int>& cpus)
+{
+	if constexpr (std::is_constructible<Container, unsigned>::value)
+	{
+		Container container(threads);
+		prefill(container, key_range);
+		return run(container, threads, read_percent, operations, key_range, cpus);
+	}
+	else
+	{
+		Container container;
+		prefill(container, key_range);
+		return run(container, threads, read_percent, operations, key_range, cpus);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool pin = true;
+	if (argc > 1 && !std::strcmp(argv[1], "--no-pin"))
+	{
+		pin = false;
+		--argc;
+		++argv;
+	}
+	unsigned max_threads = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : std::thread::hardware_concurrency();
+	unsigned read_percent = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 90;
+	size_t operations = argc > 3 ? static_cast<size_t>(std::atof(argv[3])) : 1000000;
+	const char* filter = argc > 4 ? argv[4] : "";
+	uint64_t key_range = 1 << 20;
+	if (max_threads == 0)
+		max_threads = 1;
+	std::vector<int> cpus = pin ? allowed_cpus() : std::vector<int>();
+
+	struct entry
+	{
+		const char* name;
+		result      (*run)(unsigned, unsigned, size_t, uint64_t, const std::vector<int>&);
+	};
+	const entry modes[] = {
+		{ "mutex",          measure<mutex_sb_tree> },
+		{ "shared_mutex",   measure<shared_mutex_sb_tree> },
+		{ "concurrent",     measure<concurrent_mode<1>> },
+		{ "concurrent/256", measure<concurrent_mode<256>> },
+		{ "sharded",        measure<sharded_mode> },
+		{ "rcu",            measure<rcu_mode> },
+	};
+
+	std::printf("read %u%%, %zu operations per thread, %llu keys, threads %s\n", read_percent, operations,
+		static_cast<unsigned long long>(key_range), cpus.empty() ? "not pinned" : "pinned");
+	std::printf("%-14s %8s %10s %10s %9s %9s %9s %12s %12s\n", "mode", "threads", "Mops/s", "efficiency",
+		"p50 ns", "p99 ns", "p99.9 ns", "min p99 ns", "max p99 ns");
+	// 1, 2, 4, ... below max_threads, then max_threads
+	std::vector<unsigned> thread_counts;
+	for (unsigned threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+	for (const entry& e : modes)
+	{
+		if (!std::strstr(e.name, filter))
+			continue;
+		double single = 0.0;
+		for (unsigned threads : thread_counts)
+		{
+			result r = e.run(threads, read_percent, operations, key_range, cpus);
+			if (threads == 1)
+				single = r.mops;
+			std::printf("%-14s %8u %10.2f %9.0f%% %9llu %9llu %9llu %12llu %12llu\n", e.name, threads, r.mops,
+				single > 0.0 ? 100.0 * r.mops / (single * threads) : 0.0,
+				static_cast<unsigned long long>(r.p50), static_cast<unsigned long long>(r.p99),
+				static_cast<unsigned long long>(r.p999), static_cast<unsigned long long>(r.min_thread_p99),
+				static_cast<unsigned long long>(r.max_thread_p99));
+		}
+	}
+	return 0;
+}
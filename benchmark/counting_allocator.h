@@ -0,0 +1,132 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_COUNTING_ALLOCATOR_H__
+#define __RULER_COUNTING_ALLOCATOR_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Struct allocation_counts
+// A snapshot of the calls and bytes seen by counting_allocator.
+struct allocation_counts
+{
+	size_t allocations;
+	size_t deallocations;
+	size_t bytes_allocated;
+	size_t bytes_deallocated;
+
+	inline allocation_counts operator-(const allocation_counts& rhs) const noexcept
+	{
+		return allocation_counts{
+			allocations - rhs.allocations,
+			deallocations - rhs.deallocations,
+			bytes_allocated - rhs.bytes_allocated,
+			bytes_deallocated - rhs.bytes_deallocated
+		};
+	}
+};
+
+// Struct template counting_allocator_counter
+// The counters shared by every counting_allocator with the same Tag.
+template <class Tag>
+struct counting_allocator_counter
+{
+	static inline std::atomic<size_t> allocations{ 0 };
+	static inline std::atomic<size_t> deallocations{ 0 };
+	static inline std::atomic<size_t> bytes_allocated{ 0 };
+	static inline std::atomic<size_t> bytes_deallocated{ 0 };
+};
+
+// Class template counting_allocator
+// A std::allocator that counts its allocate and deallocate calls and bytes,
+// for the benchmark programs. sb_tree default-constructs its rebound node
+// allocator, so the counters cannot live in the instance; they are shared by
+// every counting_allocator with the same Tag, whatever T, and updated with
+// relaxed atomics so that concurrent containers may use it too.
+template <class T, class Tag = void>
+class counting_allocator
+{
+public:
+	using value_type = T;
+
+	template <class U>
+	struct rebind
+	{
+		using other = counting_allocator<U, Tag>;
+	};
+
+	counting_allocator(void) noexcept
+	{}
+	template <class U>
+	counting_allocator(const counting_allocator<U, Tag>&) noexcept
+	{}
+
+	inline T* allocate(size_t n)
+	{
+		T* p = std::allocator<T>().allocate(n);
+		counter::allocations.fetch_add(1, std::memory_order_relaxed);
+		counter::bytes_allocated.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+		return p;
+	}
+
+	inline void deallocate(T* p, size_t n) noexcept
+	{
+		counter::deallocations.fetch_add(1, std::memory_order_relaxed);
+		counter::bytes_deallocated.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+		std::allocator<T>().deallocate(p, n);
+	}
+
+	static allocation_counts counts(void) noexcept
+	{
+		return allocation_counts{
+			counter::allocations.load(std::memory_order_relaxed),
+			counter::deallocations.load(std::memory_order_relaxed),
+			counter::bytes_allocated.load(std::memory_order_relaxed),
+			counter::bytes_deallocated.load(std::memory_order_relaxed)
+		};
+	}
+
+	template <class U>
+	inline bool operator==(const counting_allocator<U, Tag>&) const noexcept
+	{
+		return true;
+	}
+	template <class U>
+	inline bool operator!=(const counting_allocator<U, Tag>&) const noexcept
+	{
+		return false;
+	}
+
+private:
+	using counter = counting_allocator_counter<Tag>;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Throughput of durable_sb_tree against the same sb_tree in memory, under
+// uniform insertions with one erasure in four, for several group commit
+// sizes, with and without automatic checkpoints:
+//
+//   ops        operations run; small groups run fewer, at most 2000 syncs
+//   ns/op      wall time per operation, the final commit included
+//   Mops/s     operations per second
+//   syncs/s    log syncs per second, one per group
+//   slowdown   ns/op over the ns/op of the tree in memory
+//
+// usage: durable_benchmark [operations] [directory]
+//
+// The log and the checkpoints are written to directory (/tmp by default),
+// whose file system decides the cost of a sync. POSIX only.
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "../durable_sb_tree.h"
+#include "../sb_tree.h"
+#include "workload.h"
+
+using clock_type = std::chrono::steady_clock;
+using tree_type  = sb_tree<uint64_t>;
+
+template <class Tree>
+static void run_ops(Tree& t, const std::vector<uint64_t>& keys, size_t ops)
+{
+	for (size_t i = 0; i < ops; ++i)
+	{
+		if (i % 4 == 3)
+			t.erase(keys[i - 1]);
+		else
+			t.insert_equal(keys[i]);
+	}
+}
+
+static double memory_ns(const std::vector<uint64_t>& keys, size_t ops)
+{
+	tree_type t;
+	auto first = clock_type::now();
+	run_ops(t, keys, ops);
+	auto last = clock_type::now();
+	return std::chrono::duration<double, std::nano>(last - first).count() / ops;
+}
+
+static void report(const char* name, size_t group, size_t ops, double ns, double base)
+{
+	std::printf("%-12s %8zu %10zu %10.1f %8.3f %10.0f %9.1fx\n", name, group, ops, ns, 1e3 / ns,
+		group ? 1e9 / (ns * group) : 0.0, ns / base);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t operations = argc > 1 ? static_cast<size_t>(std::atof(argv[1])) : 1000000;
+	std::string directory = argc > 2 ? argv[2] : "/tmp";
+	if (!operations)
+		operations = 1;
+	std::vector<uint64_t> keys = generate_keys(key_distribution::uniform, operations, operations * 4, 1);
+	std::string path = directory + "/durable_benchmark." + std::to_string(::getpid());
+
+	double base = memory_ns(keys, operations);
+	std::printf("%-12s %8s %10s %10s %8s %10s %10s\n", "tree", "group", "ops", "ns/op", "Mops/s", "syncs/s", "slowdown");
+	report("memory", 0, operations, base, base);
+	for (size_t checkpoint : { size_t(0), operations / 4 })
+	{
+		for (size_t group : { 1, 16, 256, 4096 })
+		{
+			size_t ops = std::min(operations, group * 2000);
+			double ns;
+			{
+				durable_sb_tree<tree_type> t(path, group, checkpoint);
+				auto first = clock_type::now();
+				run_ops(t, keys, ops);
+				t.commit();
+				auto last = clock_type::now();
+				ns = std::chrono::duration<double, std::nano>(last - first).count() / ops;
+			}
+			report(checkpoint ? "checkpoints" : "log only", group, ops, ns, memory_ns(keys, ops));
+			std::remove((path + ".log").c_str());
+			std::remove((path + ".ckpt").c_str());
+		}
+	}
+	return 0;
+}
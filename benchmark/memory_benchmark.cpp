@@ -0,0 +1,278 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Memory footprint of sb_tree<uint64_t> and sb_tree<std::string> at growing
+// sizes, up to the memory available to the process. Each size is built in a
+// child process, so that every measurement starts from a fresh heap:
+//
+//   RSS          resident set of the child after the build
+//   B/elem       growth of the resident set per element
+//   heap B/elem  bytes the allocator reports in use per element
+//   churn        after erasing the oldest churn elements and inserting as
+//                many new ones, the resident set per element and the share
+//                of the heap left free inside the arena (fragmentation)
+//   clear        time to clear() the tree and the resident set after it
+//
+// usage: memory_benchmark [max size] [churn ratio] [type filter]
+//
+// The sizes grow tenfold from 1e3 to max size (2e9 by default), which is also
+// measured when it is not a power of ten. A size stops the run when the
+// previous size projects it above 90% of the available memory (MemAvailable
+// and the cgroup limit). The string keys have 20 to 43 characters, beyond
+// the small string buffer, so that each one also allocates a block of one of
+// several sizes. Linux only.
+
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../sb_tree.h"
+#include "workload.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// the resident set of the process in bytes
+static size_t resident_bytes(void)
+{
+	unsigned long long pages = 0, resident = 0;
+	FILE* f = std::fopen("/proc/self/statm", "r");
+	if (f)
+	{
+		if (std::fscanf(f, "%llu %llu", &pages, &resident) != 2)
+			resident = 0;
+		std::fclose(f);
+	}
+	return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// the highest resident set of the process in bytes, VmHWM, or ru_maxrss when
+// /proc/self/status does not report it
+static size_t peak_resident_bytes(void)
+{
+	unsigned long long peak = 0;
+	char line[256];
+	FILE* f = std::fopen("/proc/self/status", "r");
+	if (f)
+	{
+		while (std::fgets(line, sizeof(line), f))
+			if (std::sscanf(line, "VmHWM: %llu kB", &peak) == 1)
+				break;
+		std::fclose(f);
+	}
+	if (!peak)
+	{
+		struct rusage usage;
+		if (!getrusage(RUSAGE_SELF, &usage))
+			peak = static_cast<unsigned long long>(usage.ru_maxrss);
+	}
+	return static_cast<size_t>(peak) * 1024;
+}
+
+// MemAvailable, lowered to the cgroup limit when there is one
+static size_t available_bytes(void)
+{
+	unsigned long long available = ~0ull;
+	char line[256];
+	FILE* f = std::fopen("/proc/meminfo", "r");
+	if (f)
+	{
+		while (std::fgets(line, sizeof(line), f))
+			if (std::sscanf(line, "MemAvailable: %llu kB", &available) == 1)
+			{
+				available *= 1024;
+				break;
+			}
+		std::fclose(f);
+	}
+	const char* limits[] = { "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes" };
+	for (const char* path : limits)
+	{
+		unsigned long long limit = 0;
+		f = std::fopen(path, "r");
+		if (!f)
+			continue;
+		if (std::fscanf(f, "%llu", &limit) == 1 && limit < available)
+			available = limit;
+		std::fclose(f);
+	}
+	return static_cast<size_t>(available);
+}
+
+struct heap_state
+{
+	size_t in_use; // allocated chunks
+	size_t free;   // free chunks kept inside the arena
+};
+
+static heap_state heap(void)
+{
+	struct mallinfo2 m = mallinfo2();
+	return heap_state{ m.uordblks + m.hblkhd, m.fordblks };
+}
+
+// distinct keys in random order
+struct uint64_keys
+{
+	using value_type = uint64_t;
+
+	static const char* name(void) { return "uint64_t"; }
+	static value_type key(uint64_t i) { return scramble(i); }
+};
+
+struct string_keys
+{
+	using value_type = std::string;
+
+	static const char* name(void) { return "std::string"; }
+	static value_type key(uint64_t i)
+	{
+		char buffer[48];
+		uint64_t h = scramble(i);
+		std::snprintf(buffer, sizeof(buffer), "key-%016" PRIx64 "%.*s", h,
+			static_cast<int>(h % 24), "abcdefghijklmnopqrstuvwx");
+		return value_type(buffer);
+	}
+};
+
+// Builds, churns and clears a tree of n elements and prints one line; runs in
+// the child process.
+template <class Keys>
+static void measure(size_t n, double churn_ratio)
+{
+	using tree_type = sb_tree<typename Keys::value_type>;
+	size_t churn = static_cast<size_t>(n * churn_ratio);
+	size_t rss_base = resident_bytes();
+	heap_state heap_base = heap();
+
+	tree_type t;
+	auto first = clock_type::now();
+	for (uint64_t i = 0; i < n; ++i)
+		t.insert_equal(Keys::key(i));
+	auto last = clock_type::now();
+	double build_s = std::chrono::duration<double>(last - first).count();
+	size_t rss_build = resident_bytes();
+	heap_state heap_build = heap();
+
+	for (uint64_t i = 0; i < churn; ++i)
+	{
+		t.erase(Keys::key(i));
+		t.insert_equal(Keys::key(n + i));
+	}
+	size_t rss_churn = resident_bytes();
+	heap_state heap_churn = heap();
+
+	first = clock_type::now();
+	t.clear();
+	last = clock_type::now();
+	double clear_ms = std::chrono::duration<double, std::milli>(last - first).count();
+	size_t rss_clear = resident_bytes();
+
+	double d = n ? static_cast<double>(n) : 1.0;
+	double arena = static_cast<double>(heap_churn.in_use + heap_churn.free);
+	std::printf("%-12s %12zu %9.2f %10.1f %8.1f %12.1f %14.1f %10.1f%% %10.1f %12.1f\n",
+		Keys::name(), n, build_s, rss_build / 1048576.0, (rss_build - rss_base) / d,
+		(heap_build.in_use - heap_base.in_use) / d, (rss_churn - rss_base) / d,
+		arena > 0.0 ? 100.0 * heap_churn.free / arena : 0.0, clear_ms, rss_clear / 1048576.0);
+	std::fflush(stdout);
+}
+
+// Runs every size in a child and stops at the memory limit or when a child
+// fails, e.g. when it is killed by the OOM killer.
+template <class Keys>
+static void run(size_t max_size, double churn_ratio)
+{
+	std::vector<size_t> sizes;
+	for (size_t n = 1000; n <= max_size; n *= 10)
+		sizes.push_back(n);
+	if (sizes.empty() || sizes.back() != max_size)
+		sizes.push_back(max_size);
+	size_t limit = available_bytes() / 10 * 9;
+	double per_element = 0.0;
+	for (size_t n : sizes)
+	{
+		if (per_element > 0.0 && per_element * n > limit)
+		{
+			std::printf("%-12s %12zu stopped: needs about %.1f GB, %.1f GB available\n", Keys::name(), n,
+				per_element * n / 1e9, limit / 1e9);
+			break;
+		}
+		int fds[2];
+		if (pipe(fds))
+			break;
+		std::fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			measure<Keys>(n, churn_ratio);
+			// the peak footprint per element, for the projection of the next size;
+			// the resident set now is after clear() and no longer the peak
+			double peak = static_cast<double>(peak_resident_bytes()) / n;
+			ssize_t written = write(fds[1], &peak, sizeof(peak));
+			std::_Exit(written == static_cast<ssize_t>(sizeof(peak)) ? 0 : 1);
+		}
+		close(fds[1]);
+		double peak = 0.0;
+		bool received = pid > 0 && read(fds[0], &peak, sizeof(peak)) == static_cast<ssize_t>(sizeof(peak));
+		close(fds[0]);
+		int status = 0;
+		if (pid > 0)
+			waitpid(pid, &status, 0);
+		if (!received || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			std::printf("%-12s %12zu failed%s\n", Keys::name(), n,
+				pid > 0 && WIFSIGNALED(status) ? " (killed, out of memory?)" : "");
+			break;
+		}
+		per_element = peak;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t max_size = argc > 1 ? static_cast<size_t>(std::atof(argv[1])) : 2000000000;
+	double churn_ratio = argc > 2 ? std::atof(argv[2]) : 1.0;
+	const char* filter = argc > 3 ? argv[3] : "";
+
+	std::printf("%.1f GB available, churn %.2f of the size\n", available_bytes() / 1e9, churn_ratio);
+	std::printf("%-12s %12s %9s %10s %8s %12s %14s %11s %10s %12s\n", "type", "size", "build s", "RSS MB",
+		"B/elem", "heap B/elem", "churn B/elem", "churn free", "clear ms", "cleared MB");
+	if (std::strstr(uint64_keys::name(), filter))
+		run<uint64_keys>(max_size, churn_ratio);
+	if (std::strstr(string_keys::name(), filter))
+		run<string_keys>(max_size, churn_ratio);
+	return 0;
+}
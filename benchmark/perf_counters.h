@@ -0,0 +1,188 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_PERF_COUNTERS_H__
+#define __RULER_PERF_COUNTERS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Class perf_counters
+// Hardware counters of the calling thread read through perf_event_open
+// (Linux), for the benchmark programs. Each event is opened on its own, so
+// that the events the kernel or the machine refuses are simply reported as
+// unavailable; when perf_event_paranoid or a container forbids all of them,
+// open() returns false and the benchmarks print no counter columns. Counts
+// are scaled by the time each event was actually scheduled when the PMU
+// multiplexes them.
+class perf_counters
+{
+public:
+	enum event
+	{
+		instructions,
+		l1d_misses,
+		llc_misses,
+		dtlb_misses,
+		branch_misses,
+		event_count
+	};
+
+	perf_counters(void) noexcept
+	{
+		for (size_t i = 0; i < event_count; ++i)
+		{
+			fds[i] = -1;
+			values[i] = 0.0;
+		}
+	}
+
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator=(const perf_counters&) = delete;
+
+	~perf_counters(void)
+	{
+		close();
+	}
+
+	static const char* name(size_t i) noexcept
+	{
+		static const char* names[event_count] = { "instr", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss" };
+		return names[i];
+	}
+
+	// Opens every event it can and tells whether any is available.
+	bool open(void) noexcept
+	{
+#if defined(__linux__)
+		const uint32_t types[event_count] = {
+			PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+		};
+		const uint64_t configs[event_count] = {
+			PERF_COUNT_HW_INSTRUCTIONS,
+			cache(PERF_COUNT_HW_CACHE_L1D),
+			cache(PERF_COUNT_HW_CACHE_LL),
+			cache(PERF_COUNT_HW_CACHE_DTLB),
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+		bool any = false;
+		for (size_t i = 0; i < event_count; ++i)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[i];
+			attr.config = configs[i];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			any = any || fds[i] >= 0;
+		}
+		return any;
+#else
+		return false;
+#endif
+	}
+
+	void close(void) noexcept
+	{
+		for (size_t i = 0; i < event_count; ++i)
+		{
+#if defined(__linux__)
+			if (fds[i] >= 0)
+				::close(fds[i]);
+#endif
+			fds[i] = -1;
+		}
+	}
+
+	inline bool available(size_t i) const noexcept
+	{
+		return fds[i] >= 0;
+	}
+
+	inline void start(void) noexcept
+	{
+#if defined(__linux__)
+		for (size_t i = 0; i < event_count; ++i)
+		{
+			if (fds[i] >= 0)
+			{
+				ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+				ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+			}
+		}
+#endif
+	}
+
+	inline void stop(void) noexcept
+	{
+#if defined(__linux__)
+		for (size_t i = 0; i < event_count; ++i)
+		{
+			if (fds[i] < 0)
+				continue;
+			ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			uint64_t data[3] = { 0, 0, 0 };
+			values[i] = 0.0;
+			if (read(fds[i], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data)) && data[2])
+				values[i] = static_cast<double>(data[0]) * data[1] / data[2];
+		}
+#endif
+	}
+
+	// The count of the last measured phase.
+	inline double value(size_t i) const noexcept
+	{
+		return values[i];
+	}
+
+private:
+#if defined(__linux__)
+	static constexpr uint64_t cache(uint64_t id) noexcept
+	{
+		return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	}
+#endif
+
+private:
+	int    fds[event_count];
+	double values[event_count];
+};
+
+#endif
@@ -0,0 +1,320 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Single-threaded cost of every operation of sb_tree against std::multiset,
+// std::set and the order-statistics tree of pb_ds, at growing sizes and under
+// the key distributions of workload.h. Memory per element is the heap
+// footprint of the container, measured by replacing the global operator new.
+//
+// usage: sb_tree_benchmark [--perf] [max size] [queries] [container filter]
+//
+// The sizes run from 1e3 to max size (1e6 by default) in steps of ten, for
+// example "sb_tree_benchmark 1e8 1e6 sb_tree" for the sb_tree variants only.
+// --perf adds the hardware counters of each phase per operation (Linux); the
+// counters that cannot be opened are shown as "-".
+
+#include <malloc.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include "../sb_tree.h"
+#include "perf_counters.h"
+#include "workload.h"
+
+// live heap bytes, as charged by the allocator; the replacements are not inlined
+// so that the compiler does not pair operator new with free
+
+static size_t heap_bytes = 0;
+
+__attribute__((noinline)) void* operator new(size_t n)
+{
+	void* p = std::malloc(n ? n : 1);
+	if (!p)
+		throw std::bad_alloc();
+	heap_bytes += malloc_usable_size(p);
+	return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+	if (p)
+	{
+		heap_bytes -= malloc_usable_size(p);
+		std::free(p);
+	}
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+// keeps the results from being optimized away
+static uint64_t sink = 0;
+
+// container adapters
+
+template <class Tree>
+struct sb_tree_adapter
+{
+	using container_type = Tree;
+
+	static constexpr bool equal = true, unique = true, order = true;
+
+	static void insert_equal(container_type& c, uint64_t k) { c.insert_equal(k); }
+	static bool insert_unique(container_type& c, uint64_t k) { return c.insert_unique(k).second; }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { auto itr = c.lower_bound(k); return itr == c.end() ? 0 : *itr; }
+	static size_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { return *c.select(i); }
+};
+
+template <class Set, bool Equal>
+struct std_adapter
+{
+	using container_type = Set;
+
+	static constexpr bool equal = Equal, unique = !Equal, order = false;
+
+	static void insert_equal(container_type& c, uint64_t k) { c.insert(k); }
+	static bool insert_unique(container_type& c, uint64_t k) { return c.insert(k).second; }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { auto itr = c.lower_bound(k); return itr == c.end() ? 0 : *itr; }
+};
+
+struct pbds_adapter
+{
+	using container_type = __gnu_pbds::tree<uint64_t, __gnu_pbds::null_type, std::less<uint64_t>,
+		__gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update>;
+
+	static constexpr bool equal = false, unique = true, order = true;
+
+	static bool insert_unique(container_type& c, uint64_t k) { return c.insert(k).second; }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { auto itr = c.lower_bound(k); return itr == c.end() ? 0 : *itr; }
+	static size_t rank(container_type& c, uint64_t k) { return c.order_of_key(k); }
+	static uint64_t select(container_type& c, size_t i) { return *c.find_by_order(i); }
+};
+
+// measurement
+
+struct workload
+{
+	key_distribution      dist;
+	std::vector<uint64_t> keys;
+	std::vector<uint64_t> queries;
+};
+
+// hardware counters of the last timed phase, when --perf is given
+static perf_counters counters;
+static bool          perf_enabled = false;
+
+template <class Function>
+static double time_ns(Function f)
+{
+	if (perf_enabled)
+		counters.start();
+	auto first = std::chrono::steady_clock::now();
+	f();
+	auto last = std::chrono::steady_clock::now();
+	if (perf_enabled)
+		counters.stop();
+	return std::chrono::duration<double, std::nano>(last - first).count();
+}
+
+static void report(const char* container, const workload& w, const char* op, double ns, size_t ops, double bytes)
+{
+	double per_op = ops ? ns / ops : 0.0;
+	std::printf("%-14s %-12s %10zu %-14s %10.1f %10.2f", container, key_distribution_name[static_cast<size_t>(w.dist)],
+		w.keys.size(), op, per_op, per_op > 0.0 ? 1e3 / per_op : 0.0);
+	if (bytes > 0.0)
+		std::printf(" %10.1f", bytes);
+	else if (perf_enabled)
+		std::printf(" %10s", "");
+	if (perf_enabled)
+	{
+		for (size_t i = 0; i < perf_counters::event_count; ++i)
+		{
+			if (counters.available(i) && ops)
+				std::printf(" %10.2f", counters.value(i) / ops);
+			else
+				std::printf(" %10s", "-");
+		}
+	}
+	std::printf("\n");
+}
+
+template <class Adapter>
+static void run(const char* name, const workload& w)
+{
+	using container_type = typename Adapter::container_type;
+	const std::vector<uint64_t>& keys = w.keys;
+	const std::vector<uint64_t>& queries = w.queries;
+	size_t before = heap_bytes;
+	container_type c;
+
+	// the container measured by the queries is built with its natural insert
+	if constexpr (Adapter::equal)
+	{
+		double ns = time_ns([&] {
+			for (uint64_t k : keys)
+				Adapter::insert_equal(c, k);
+		});
+		report(name, w, "insert_equal", ns, keys.size(), double(heap_bytes - before) / c.size());
+	}
+	if constexpr (Adapter::unique)
+	{
+		container_type u;
+		size_t base = heap_bytes;
+		double ns = time_ns([&] {
+			for (uint64_t k : keys)
+				sink += Adapter::insert_unique(u, k);
+		});
+		report(name, w, "insert_unique", ns, keys.size(), double(heap_bytes - base) / u.size());
+		if (!Adapter::equal)
+			c.swap(u);
+	}
+	double ns = time_ns([&] {
+		for (uint64_t k : queries)
+			sink += Adapter::find(c, k);
+	});
+	report(name, w, "find", ns, queries.size(), 0.0);
+	ns = time_ns([&] {
+		for (uint64_t k : queries)
+			sink += Adapter::lower_bound(c, k);
+	});
+	report(name, w, "lower_bound", ns, queries.size(), 0.0);
+	if constexpr (Adapter::order)
+	{
+		ns = time_ns([&] {
+			for (uint64_t k : queries)
+				sink += Adapter::rank(c, k);
+		});
+		report(name, w, "rank", ns, queries.size(), 0.0);
+		size_t n = c.size();
+		ns = time_ns([&] {
+			for (uint64_t k : queries)
+				sink += Adapter::select(c, static_cast<size_t>(scramble(k) % n));
+		});
+		report(name, w, "select", ns, queries.size(), 0.0);
+	}
+	ns = time_ns([&] {
+		for (uint64_t k : c)
+			sink += k;
+	});
+	report(name, w, "iterate", ns, c.size(), 0.0);
+	{
+		// the copy is destroyed outside the timed region
+		alignas(container_type) unsigned char storage[sizeof(container_type)];
+		container_type* copy = nullptr;
+		ns = time_ns([&] { copy = new (storage) container_type(c); });
+		report(name, w, "copy", ns, c.size(), 0.0);
+		copy->~container_type();
+	}
+	ns = time_ns([&] {
+		for (uint64_t k : keys)
+			sink += Adapter::erase(c, k);
+	});
+	report(name, w, "erase", ns, keys.size(), 0.0);
+}
+
+using size_tree   = sb_tree<uint64_t>;
+using weight_tree = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_weight_balance<>>;
+using treap_tree  = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_treap_balance>;
+using splay_tree  = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_splay_balance>;
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && !std::strcmp(argv[1], "--perf"))
+	{
+		perf_enabled = true;
+		--argc;
+		++argv;
+	}
+	size_t max_size = argc > 1 ? static_cast<size_t>(std::atof(argv[1])) : 1000000;
+	size_t queries = argc > 2 ? static_cast<size_t>(std::atof(argv[2])) : 1000000;
+	const char* filter = argc > 3 ? argv[3] : "";
+
+	struct entry
+	{
+		const char* name;
+		void        (*run)(const char*, const workload&);
+		bool        selected; // runs without being named by the filter
+	};
+	const entry containers[] = {
+		{ "sb_tree",        run<sb_tree_adapter<size_tree>>,                   true },
+		{ "sb_tree/weight", run<sb_tree_adapter<weight_tree>>,                 true },
+		{ "sb_tree/treap",  run<sb_tree_adapter<treap_tree>>,                  true },
+		// rank and select do not splay, so they take linear time after sorted inserts
+		{ "sb_tree/splay",  run<sb_tree_adapter<splay_tree>>,                  false },
+		{ "std::multiset",  run<std_adapter<std::multiset<uint64_t>, true>>, true },
+		{ "std::set",       run<std_adapter<std::set<uint64_t>, false>>,     true },
+		{ "pb_ds::tree",    run<pbds_adapter>,                                 true },
+	};
+
+	if (perf_enabled && !counters.open())
+	{
+		std::fprintf(stderr, "hardware counters are not available (see perf_event_paranoid), running without them\n");
+		perf_enabled = false;
+	}
+	std::printf("%-14s %-12s %10s %-14s %10s %10s %10s",
+		"container", "keys", "size", "operation", "ns/op", "Mops/s", "bytes/elem");
+	if (perf_enabled)
+		for (size_t i = 0; i < perf_counters::event_count; ++i)
+			std::printf(" %10s", perf_counters::name(i));
+	std::printf("\n");
+	for (size_t n = 1000; n <= max_size; n *= 10)
+	{
+		for (size_t d = 0; d < key_distribution_count; ++d)
+		{
+			workload w;
+			w.dist = static_cast<key_distribution>(d);
+			w.keys = generate_keys(w.dist, n, n, 1);
+			w.queries = generate_keys(w.dist, queries, n, 2);
+			for (const entry& e : containers)
+				if (*filter ? std::strstr(e.name, filter) != nullptr : e.selected)
+					e.run(e.name, w);
+		}
+	}
+	std::fprintf(stderr, "%llu\n", static_cast<unsigned long long>(sink & 1));
+	return 0;
+}
@@ -0,0 +1,259 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Replays an operation trace recorded by traced_sb_tree into sb_tree and
+// other containers, starting from an empty container, and reports the
+// latency of each kind of operation. Results that differ from the recorded
+// ones are counted; hashed keys keep equality but not order, so their range
+// and rank results may differ.
+//
+// usage: trace_replay <trace> [container filter]
+//        trace_replay --record <trace> [operations]
+//
+// The second form records a synthetic mixed workload, for trying the tool.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <set>
+#include <vector>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include "../sb_tree.h"
+#include "../sb_tree_trace.h"
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr size_t op_count = 11;
+
+static const char* op_name[op_count] = {
+	"", "insert_equal", "insert_unique", "erase", "find", "lower_bound", "upper_bound", "rank", "select",
+	"erase_one", "clear"
+};
+
+// container adapters; each call returns the result size of the record
+
+template <class Tree>
+struct sb_tree_adapter
+{
+	using container_type = Tree;
+
+	static constexpr bool order = true;
+
+	static uint64_t insert_equal(container_type& c, uint64_t k) { c.insert_equal(k); return 1; }
+	static uint64_t insert_unique(container_type& c, uint64_t k) { return c.insert_unique(k).second; }
+	static uint64_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static uint64_t find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { return c.lower_bound(k) != c.end(); }
+	static uint64_t upper_bound(container_type& c, uint64_t k) { return c.upper_bound(k) != c.end(); }
+	static uint64_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, uint64_t i) { return c.select(i) != c.end(); }
+	static uint64_t erase_one(container_type& c, uint64_t k) { auto it = c.find(k); return it != c.end() ? (c.erase(it), 1) : 0; }
+	static uint64_t clear(container_type& c) { uint64_t n = c.size(); c.clear(); return n; }
+};
+
+struct multiset_adapter
+{
+	using container_type = std::multiset<uint64_t>;
+
+	static constexpr bool order = false;
+
+	static uint64_t insert_equal(container_type& c, uint64_t k) { c.insert(k); return 1; }
+	static uint64_t insert_unique(container_type& c, uint64_t k) { return c.count(k) ? 0 : (c.insert(k), 1); }
+	static uint64_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static uint64_t find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { return c.lower_bound(k) != c.end(); }
+	static uint64_t upper_bound(container_type& c, uint64_t k) { return c.upper_bound(k) != c.end(); }
+	static uint64_t rank(container_type&, uint64_t) { return 0; }
+	static uint64_t select(container_type&, uint64_t) { return 0; }
+	static uint64_t erase_one(container_type& c, uint64_t k) { auto it = c.find(k); return it != c.end() ? (c.erase(it), 1) : 0; }
+	static uint64_t clear(container_type& c) { uint64_t n = c.size(); c.clear(); return n; }
+};
+
+// pb_ds keeps unique keys, so insert_equal inserts only new keys
+struct pbds_adapter
+{
+	using container_type = __gnu_pbds::tree<uint64_t, __gnu_pbds::null_type, std::less<uint64_t>,
+		__gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update>;
+
+	static constexpr bool order = true;
+
+	static uint64_t insert_equal(container_type& c, uint64_t k) { c.insert(k); return 1; }
+	static uint64_t insert_unique(container_type& c, uint64_t k) { return c.insert(k).second; }
+	static uint64_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static uint64_t find(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static uint64_t lower_bound(container_type& c, uint64_t k) { return c.lower_bound(k) != c.end(); }
+	static uint64_t upper_bound(container_type& c, uint64_t k) { return c.upper_bound(k) != c.end(); }
+	static uint64_t rank(container_type& c, uint64_t k) { return c.order_of_key(k); }
+	static uint64_t select(container_type& c, uint64_t i) { return c.find_by_order(i) != c.end(); }
+	static uint64_t erase_one(container_type& c, uint64_t k) { return c.erase(k); }
+	static uint64_t clear(container_type& c) { uint64_t n = c.size(); c.clear(); return n; }
+};
+
+template <class Adapter>
+static inline uint64_t apply(typename Adapter::container_type& c, const sb_tree_trace_record& r)
+{
+	switch (r.op)
+	{
+	case sb_tree_trace_op::insert_equal:  return Adapter::insert_equal(c, r.key);
+	case sb_tree_trace_op::insert_unique: return Adapter::insert_unique(c, r.key);
+	case sb_tree_trace_op::erase:         return Adapter::erase(c, r.key);
+	case sb_tree_trace_op::find:          return Adapter::find(c, r.key);
+	case sb_tree_trace_op::lower_bound:   return Adapter::lower_bound(c, r.key);
+	case sb_tree_trace_op::upper_bound:   return Adapter::upper_bound(c, r.key);
+	case sb_tree_trace_op::rank:          return Adapter::rank(c, r.key);
+	case sb_tree_trace_op::select:        return Adapter::select(c, r.key);
+	case sb_tree_trace_op::erase_one:     return Adapter::erase_one(c, r.key);
+	case sb_tree_trace_op::clear:         return Adapter::clear(c);
+	}
+	return 0;
+}
+
+// the cost of reading the clock twice, subtracted from every sample
+static double clock_overhead(void)
+{
+	double best = 1e9;
+	for (int i = 0; i < 10000; ++i)
+	{
+		auto first = clock_type::now();
+		auto last = clock_type::now();
+		best = std::min(best, std::chrono::duration<double, std::nano>(last - first).count());
+	}
+	return best;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+template <class Adapter>
+static void replay(const char* name, const std::vector<sb_tree_trace_record>& trace, double overhead)
+{
+	typename Adapter::container_type c;
+	std::vector<double> latency[op_count];
+	size_t mismatches = 0;
+	for (const sb_tree_trace_record& r : trace)
+	{
+		auto op = static_cast<size_t>(r.op);
+		if (op == 0 || op >= op_count)
+			continue;
+		if (!Adapter::order && (r.op == sb_tree_trace_op::rank || r.op == sb_tree_trace_op::select))
+			continue;
+		auto first = clock_type::now();
+		uint64_t result = apply<Adapter>(c, r);
+		auto last = clock_type::now();
+		latency[op].push_back(std::max(0.0, std::chrono::duration<double, std::nano>(last - first).count() - overhead));
+		if ((result > UINT32_MAX ? UINT32_MAX : result) != r.result)
+			++mismatches;
+	}
+	for (size_t op = 1; op < op_count; ++op)
+	{
+		std::vector<double>& v = latency[op];
+		if (v.empty())
+			continue;
+		double sum = 0.0;
+		for (double ns : v)
+			sum += ns;
+		std::sort(v.begin(), v.end());
+		std::printf("%-14s %-14s %10zu %9.1f %9.1f %9.1f %9.1f %10.1f\n", name, op_name[op], v.size(), sum / v.size(),
+			percentile(v, 0.5), percentile(v, 0.99), percentile(v, 0.999), v.back());
+	}
+	std::printf("%-14s %zu results differ from the trace\n", name, mismatches);
+}
+
+static int record(const char* path, size_t operations)
+{
+	std::ofstream os(path, std::ios::binary | std::ios::trunc);
+	traced_sb_tree<sb_tree<uint64_t>> tree(os);
+	std::mt19937_64 rng(1);
+	for (size_t i = 0; i < operations; ++i)
+	{
+		uint64_t key = rng() % (operations / 2 + 1);
+		switch (rng() % 8)
+		{
+		case 0: tree.insert_equal(key); break;
+		case 1: tree.insert_equal(tree.tree().cend(), key); break;
+		case 2: key & 1 ? tree.erase(key) : (tree.erase(tree.lower_bound(key)), 0); break;
+		case 3: case 4: tree.find(key); break;
+		case 5: tree.lower_bound(key); break;
+		case 6: tree.rank(key); break;
+		default: tree.size() ? tree.select(key % tree.size()) : tree.find(key); break;
+		}
+	}
+	tree.flush();
+	return 0;
+}
+
+using weight_tree = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_weight_balance<>>;
+using treap_tree  = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_treap_balance>;
+
+int main(int argc, char* argv[])
+{
+	if (argc > 2 && !std::strcmp(argv[1], "--record"))
+		return record(argv[2], argc > 3 ? static_cast<size_t>(std::atof(argv[3])) : 1000000);
+	if (argc < 2)
+	{
+		std::fprintf(stderr, "usage: trace_replay <trace> [container filter]\n"
+			"       trace_replay --record <trace> [operations]\n");
+		return 1;
+	}
+	const char* filter = argc > 2 ? argv[2] : "";
+	std::ifstream is(argv[1], std::ios::binary);
+	std::vector<sb_tree_trace_record> trace = sb_tree_read_trace(is);
+	double overhead = clock_overhead();
+
+	struct entry
+	{
+		const char* name;
+		void        (*run)(const char*, const std::vector<sb_tree_trace_record>&, double);
+	};
+	const entry containers[] = {
+		{ "sb_tree",        replay<sb_tree_adapter<sb_tree<uint64_t>>> },
+		{ "sb_tree/weight", replay<sb_tree_adapter<weight_tree>> },
+		{ "sb_tree/treap",  replay<sb_tree_adapter<treap_tree>> },
+		{ "std::multiset",  replay<multiset_adapter> },
+		{ "pb_ds::tree",    replay<pbds_adapter> },
+	};
+
+	std::printf("%zu records, clock overhead %.1f ns subtracted\n", trace.size(), overhead);
+	std::printf("%-14s %-14s %10s %9s %9s %9s %9s %10s\n",
+		"container", "operation", "count", "mean ns", "p50", "p99", "p99.9", "max");
+	for (const entry& e : containers)
+		if (std::strstr(e.name, filter))
+			e.run(e.name, trace, overhead);
+	return 0;
+}
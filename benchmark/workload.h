@@ -0,0 +1,302 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_WORKLOAD_H__
+#define __RULER_WORKLOAD_H__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Key sequences and mixed operation streams for the benchmark programs.
+// Every generator takes a seed, so that a run can be repeated exactly.
+
+enum class key_distribution
+{
+	uniform,
+	zipf,
+	sorted,
+	reverse,
+	sawtooth,
+	clustered,
+	adversarial
+};
+
+static constexpr size_t key_distribution_count = 7;
+
+static const char* const key_distribution_name[key_distribution_count] = {
+	"uniform", "zipf", "sorted", "reverse", "sawtooth", "clustered", "adversarial"
+};
+
+// bijective mixing, so that popular zipf ranks are spread over the key space
+inline uint64_t scramble(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// Class zipf_generator
+// Zipf(s) over the ranks 1..n by rejection-inversion (Hormann and Derflinger),
+// constant time and space per sample at any n.
+class zipf_generator
+{
+public:
+	zipf_generator(uint64_t n, double s)
+		: n(n)
+		, s(s)
+		, h_x1(h(1.5) - 1.0)
+		, h_n(h(n + 0.5))
+		, threshold(2.0 - h_inverse(h(2.5) - std::pow(2.0, -s)))
+	{}
+
+	template <class Random>
+	uint64_t operator()(Random& rng)
+	{
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		for (;;)
+		{
+			double u = h_n + unit(rng) * (h_x1 - h_n);
+			double x = h_inverse(u);
+			double k = std::floor(x + 0.5);
+			if (k < 1.0)
+				k = 1.0;
+			else if (k > n)
+				k = static_cast<double>(n);
+			if (k - x <= threshold || u >= h(k + 0.5) - std::exp(-s * std::log(k)))
+				return static_cast<uint64_t>(k);
+		}
+	}
+
+private:
+	static double expm1_ratio(double x)
+	{
+		return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x / 2.0 * (1.0 + x / 3.0);
+	}
+
+	static double log1p_ratio(double x)
+	{
+		return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x / 2.0 * (1.0 - x * 2.0 / 3.0);
+	}
+
+	double h(double x) const
+	{
+		double log_x = std::log(x);
+		return expm1_ratio((1.0 - s) * log_x) * log_x;
+	}
+
+	double h_inverse(double x) const
+	{
+		double t = x * (1.0 - s);
+		if (t < -1.0)
+			t = -1.0;
+		return std::exp(log1p_ratio(t) * x);
+	}
+
+	uint64_t n;
+	double   s;
+	double   h_x1;
+	double   h_n;
+	double   threshold;
+};
+
+// Struct key_options
+// The shape parameters of the distributions that have one.
+struct key_options
+{
+	double zipf_s       = 0.99; // zipf exponent
+	size_t sawtooth_run = 1024; // length of each ascending run
+	size_t clusters     = 16;   // number of dense key ranges
+};
+
+// Generates n keys of the distribution over a domain of about domain keys.
+// The sorted, reverse, sawtooth and adversarial sequences have no duplicates
+// when n <= domain.
+//
+// sawtooth:    ascending runs that each start just above the previous start,
+//              so that every run sweeps the whole key range once.
+// clustered:   keys drawn uniformly inside a few narrow ranges at random
+//              positions, as with time stamps or per-tenant identifiers.
+// adversarial: both ends towards the middle, so that every insertion lands
+//              on the inner grandchild side. It takes the double rotation of
+//              cases 1 and 3 of sb_tree_size_balance::insert_rebalance on
+//              about 0.69 insertions in 1, against 0.26 for uniform keys and
+//              none for sorted ones, with 1.8 rotations per insertion.
+inline std::vector<uint64_t> generate_keys(key_distribution d, size_t n, uint64_t domain, uint64_t seed,
+	const key_options& options = key_options())
+{
+	std::vector<uint64_t> keys(n);
+	std::mt19937_64 rng(seed);
+	if (!domain)
+		domain = 1;
+	switch (d)
+	{
+	case key_distribution::uniform:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = rng() % (domain * 4);
+		break;
+	case key_distribution::zipf:
+	{
+		zipf_generator zipf(domain, options.zipf_s);
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = scramble(zipf(rng));
+		break;
+	}
+	case key_distribution::sorted:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = i % domain;
+		break;
+	case key_distribution::reverse:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = domain - 1 - i % domain;
+		break;
+	case key_distribution::sawtooth:
+	{
+		size_t run = options.sawtooth_run ? options.sawtooth_run : 1;
+		uint64_t runs = (domain + run - 1) / run;
+		// the positions p map one to one onto [0, run * runs); the keys
+		// beyond the domain are skipped rather than wrapped onto others
+		uint64_t p = 0;
+		for (size_t i = 0; i < n; ++p)
+		{
+			uint64_t key = p % run * runs + p / run % runs;
+			if (key < domain)
+				keys[i++] = key;
+		}
+		break;
+	}
+	case key_distribution::clustered:
+	{
+		size_t clusters = options.clusters ? options.clusters : 1;
+		uint64_t width = domain / clusters + 1;
+		std::vector<uint64_t> base(clusters);
+		for (uint64_t& b : base)
+			b = rng() % (domain * 4);
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = base[rng() % clusters] + rng() % width;
+		break;
+	}
+	case key_distribution::adversarial:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = (i & 1 ? domain - 1 - i / 2 : i / 2) % domain;
+		break;
+	}
+	return keys;
+}
+
+// mixed operation streams
+
+enum class workload_op : uint8_t
+{
+	read,
+	insert,
+	erase,
+	rank,
+	select
+};
+
+static constexpr size_t workload_op_count = 5;
+
+static const char* const workload_op_name[workload_op_count] = {
+	"read", "insert", "erase", "rank", "select"
+};
+
+// Struct workload_mix
+// The relative weights of the operations of a stream; they need not sum to
+// one.
+struct workload_mix
+{
+	double weight[workload_op_count] = { 60.0, 15.0, 15.0, 5.0, 5.0 };
+
+	// Parses "read:insert:erase:rank:select", e.g. "50:25:25:0:0"; missing
+	// trailing weights are zero. Returns false on a malformed string.
+	bool parse(const char* s)
+	{
+		double w[workload_op_count] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+		double total = 0.0;
+		for (size_t i = 0; i < workload_op_count && *s; ++i)
+		{
+			int used = 0;
+			if (std::sscanf(s, "%lf%n", &w[i], &used) != 1 || w[i] < 0.0)
+				return false;
+			total += w[i];
+			s += used;
+			if (*s == ':')
+				++s;
+			else if (*s)
+				return false;
+		}
+		if (*s || total <= 0.0)
+			return false;
+		for (size_t i = 0; i < workload_op_count; ++i)
+			weight[i] = w[i];
+		return true;
+	}
+};
+
+// Struct workload_step
+// One operation of a stream. The key of a select is an index to be reduced
+// modulo the size of the container when it runs.
+struct workload_step
+{
+	workload_op op;
+	uint64_t    key;
+};
+
+// Generates n operations in the proportions of the mix. Insertions take their
+// keys from the distribution; reads, erasures and ranks take half of theirs
+// from the keys inserted so far, so that they mostly hit, and half from the
+// distribution.
+inline std::vector<workload_step> generate_ops(const workload_mix& mix, key_distribution d, size_t n,
+	uint64_t domain, uint64_t seed, const key_options& options = key_options())
+{
+	std::vector<uint64_t> keys = generate_keys(d, n, domain, seed, options);
+	std::vector<uint64_t> inserted;
+	std::vector<workload_step> steps(n);
+	std::mt19937_64 rng(seed ^ 0x9e3779b97f4a7c15ull);
+	std::discrete_distribution<int> pick(mix.weight, mix.weight + workload_op_count);
+	for (size_t i = 0; i < n; ++i)
+	{
+		workload_op op = static_cast<workload_op>(pick(rng));
+		uint64_t key = keys[i];
+		if (op == workload_op::select)
+			key = rng();
+		else if (op == workload_op::insert)
+			inserted.push_back(key);
+		else if (!inserted.empty() && (rng() & 1))
+			key = inserted[rng() % inserted.size()];
+		steps[i] = workload_step{ op, key };
+	}
+	return steps;
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Every sb_tree variant against every key distribution of workload.h under a
+// mixed operation stream. Each container is filled with size keys of the
+// distribution, then runs the same seeded stream of reads, insertions,
+// erasures, ranks and selects. The results of the stream are folded into a
+// checksum; a container whose checksum differs from the first one is marked.
+//
+// usage: workload_benchmark [size] [operations] [mix] [seed] [container filter]
+//
+// The mix gives the weights of "read:insert:erase:rank:select", 60:15:15:5:5
+// by default, for example "workload_benchmark 1e6 1e6 90:5:5:0:0 7 treap".
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../sb_tree.h"
+#include "../concurrent_sb_tree.h"
+#include "../persistent_sb_tree.h"
+#include "../rcu_sb_tree.h"
+#include "../sharded_sb_tree.h"
+#include "workload.h"
+
+using clock_type = std::chrono::steady_clock;
+
+// container adapters
+
+template <class Tree>
+struct sb_tree_adapter
+{
+	using container_type = Tree;
+
+	static void insert(container_type& c, uint64_t k) { c.insert_equal(k); }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool read(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static size_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { return *c.select(i); }
+	static size_t size(container_type& c) { return c.size(); }
+};
+
+// writes are applied one at a time, so that reads see them as in sb_tree
+template <class Tree>
+struct concurrent_adapter
+{
+	struct container_type : concurrent_sb_tree<Tree>
+	{
+		container_type(void)
+			: concurrent_sb_tree<Tree>(1)
+		{}
+	};
+
+	static void insert(container_type& c, uint64_t k) { c.insert_equal(k); }
+	static size_t erase(container_type& c, uint64_t k) { size_t n = c.size(); c.erase(k); return n - c.size(); }
+	static bool read(container_type& c, uint64_t k) { return c.contains(k); }
+	static size_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { uint64_t v = 0; c.select(i, v); return v; }
+	static size_t size(container_type& c) { return c.size(); }
+};
+
+template <class Tree>
+struct sharded_adapter
+{
+	using container_type = sharded_sb_tree<Tree>;
+
+	static void insert(container_type& c, uint64_t k) { c.insert_equal(k); }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool read(container_type& c, uint64_t k) { return c.contains(k); }
+	static size_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { uint64_t v = 0; c.select(i, v); return v; }
+	static size_t size(container_type& c) { return c.size(); }
+};
+
+struct persistent_adapter
+{
+	using container_type = persistent_sb_tree<uint64_t>;
+
+	static void insert(container_type& c, uint64_t k) { c.insert_equal(k); }
+	static size_t erase(container_type& c, uint64_t k) { return c.erase(k); }
+	static bool read(container_type& c, uint64_t k) { return c.find(k) != c.end(); }
+	static size_t rank(container_type& c, uint64_t k) { return c.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { return *c.select(i); }
+	static size_t size(container_type& c) { return c.size(); }
+};
+
+// the writer reads through its own reader handle
+struct rcu_adapter
+{
+	struct container_type
+	{
+		rcu_sb_tree<uint64_t>         tree{ 1 };
+		rcu_sb_tree<uint64_t>::reader reader = tree.make_reader();
+	};
+
+	static void insert(container_type& c, uint64_t k) { c.tree.insert_equal(k); }
+	static size_t erase(container_type& c, uint64_t k) { return c.tree.erase(k); }
+	static bool read(container_type& c, uint64_t k) { return c.reader.contains(k); }
+	static size_t rank(container_type& c, uint64_t k) { return c.reader.rank(k); }
+	static uint64_t select(container_type& c, size_t i) { uint64_t v = 0; c.reader.select(i, v); return v; }
+	static size_t size(container_type& c) { return c.tree.size(); }
+};
+
+// measurement
+
+struct result
+{
+	double   fill_ns;
+	double   stream_ns;
+	uint64_t checksum;
+};
+
+template <class Adapter>
+static result run(const std::vector<uint64_t>& keys, const std::vector<workload_step>& steps)
+{
+	typename Adapter::container_type c;
+	result r;
+	auto first = clock_type::now();
+	for (uint64_t k : keys)
+		Adapter::insert(c, k);
+	auto middle = clock_type::now();
+	uint64_t checksum = 0;
+	for (const workload_step& s : steps)
+	{
+		uint64_t v = 0;
+		switch (s.op)
+		{
+		case workload_op::read:
+			v = Adapter::read(c, s.key);
+			break;
+		case workload_op::insert:
+			Adapter::insert(c, s.key);
+			break;
+		case workload_op::erase:
+			v = Adapter::erase(c, s.key);
+			break;
+		case workload_op::rank:
+			v = Adapter::rank(c, s.key);
+			break;
+		case workload_op::select:
+		{
+			size_t n = Adapter::size(c);
+			v = n ? Adapter::select(c, static_cast<size_t>(s.key % n)) : 0;
+			break;
+		}
+		}
+		checksum = checksum * 0x100000001b3ull + v;
+	}
+	auto last = clock_type::now();
+	r.fill_ns = std::chrono::duration<double, std::nano>(middle - first).count();
+	r.stream_ns = std::chrono::duration<double, std::nano>(last - middle).count();
+	r.checksum = checksum;
+	return r;
+}
+
+using size_tree   = sb_tree<uint64_t>;
+using weight_tree = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_weight_balance<>>;
+using treap_tree  = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_treap_balance>;
+using splay_tree  = sb_tree<uint64_t, std::less<uint64_t>, std::allocator<uint64_t>,
+	sb_tree_plain_node_policy<uint64_t>, sb_tree_splay_balance>;
+
+int main(int argc, char* argv[])
+{
+	size_t n = argc > 1 ? static_cast<size_t>(std::atof(argv[1])) : 100000;
+	size_t ops = argc > 2 ? static_cast<size_t>(std::atof(argv[2])) : 1000000;
+	workload_mix mix;
+	if (argc > 3 && !mix.parse(argv[3]))
+	{
+		std::fprintf(stderr, "bad mix \"%s\", expected read:insert:erase:rank:select\n", argv[3]);
+		return 1;
+	}
+	uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1;
+	const char* filter = argc > 5 ? argv[5] : "";
+
+	struct entry
+	{
+		const char* name;
+		result      (*run)(const std::vector<uint64_t>&, const std::vector<workload_step>&);
+	};
+	const entry containers[] = {
+		{ "sb_tree",            run<sb_tree_adapter<size_tree>> },
+		{ "sb_tree/weight",     run<sb_tree_adapter<weight_tree>> },
+		{ "sb_tree/treap",      run<sb_tree_adapter<treap_tree>> },
+		{ "sb_tree/splay",      run<sb_tree_adapter<splay_tree>> },
+		{ "concurrent_sb_tree", run<concurrent_adapter<size_tree>> },
+		{ "sharded_sb_tree",    run<sharded_adapter<size_tree>> },
+		{ "persistent_sb_tree", run<persistent_adapter> },
+		{ "rcu_sb_tree",        run<rcu_adapter> },
+	};
+
+	std::printf("mix");
+	for (size_t i = 0; i < workload_op_count; ++i)
+		std::printf(" %s=%g", workload_op_name[i], mix.weight[i]);
+	std::printf(", seed %llu\n", static_cast<unsigned long long>(seed));
+	std::printf("%-18s %-12s %10s %12s %12s %10s %s\n",
+		"container", "keys", "size", "fill ns/key", "stream ns/op", "Mops/s", "checksum");
+	for (size_t d = 0; d < key_distribution_count; ++d)
+	{
+		key_distribution dist = static_cast<key_distribution>(d);
+		std::vector<uint64_t> keys = generate_keys(dist, n, n, seed);
+		std::vector<workload_step> steps = generate_ops(mix, dist, ops, n, seed + 1);
+		bool first = true;
+		uint64_t expected = 0;
+		for (const entry& e : containers)
+		{
+			if (!std::strstr(e.name, filter))
+				continue;
+			result r = e.run(keys, steps);
+			if (first)
+				expected = r.checksum;
+			double per_op = ops ? r.stream_ns / ops : 0.0;
+			std::printf("%-18s %-12s %10zu %12.1f %12.1f %10.2f %016llx%s\n", e.name, key_distribution_name[d], n,
+				n ? r.fill_ns / n : 0.0, per_op, per_op > 0.0 ? 1e3 / per_op : 0.0,
+				static_cast<unsigned long long>(r.checksum), r.checksum == expected ? "" : " mismatch");
+			first = false;
+		}
+	}
+	return 0;
+}
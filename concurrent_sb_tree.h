@@ -0,0 +1,314 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_CONCURRENT_SB_TREE_H__
+#define __RULER_CONCURRENT_SB_TREE_H__
+
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+#include "sb_tree.h"
+
+// Class template concurrent_sb_tree
+// Wraps a sb_tree for use from several threads. Lookups hold a shared lock,
+// so readers never serialize behind each other. Modifiers do not take the
+// tree lock: they append a command to a write buffer, and the thread whose
+// command fills the buffer applies the whole batch under a single exclusive
+// lock. A batch is sorted by key and applied through the hinted insertion and
+// finger search paths, so consecutive commands share most of their descent.
+// Commands on the same key keep their relative order. Writes become visible
+// to lookups once their batch has been applied; flush() applies the pending
+// writes immediately, and so does the destructor, which drops them if that
+// throws.
+template <class Tree>
+class concurrent_sb_tree
+{
+public:
+	// types:
+
+	using tree_type       = Tree;
+	using value_type      = typename Tree::value_type;
+	using size_type       = typename Tree::size_type;
+	using compare_type    = typename Tree::compare_type;
+	using const_iterator  = typename Tree::const_iterator;
+
+	// construct/copy/destroy:
+
+	explicit concurrent_sb_tree(size_type batch_capacity = 256)
+		: batch_size(batch_capacity ? batch_capacity : 1)
+		, tree()
+		, comp(tree.compare())
+	{
+		queue.reserve(batch_size);
+		batch.reserve(batch_size);
+	}
+
+	concurrent_sb_tree(const concurrent_sb_tree&) = delete;
+	concurrent_sb_tree& operator=(const concurrent_sb_tree&) = delete;
+
+	// Applies the pending writes before the tree is destroyed, so that their
+	// side effects on the tree, such as allocations, take place.
+	~concurrent_sb_tree(void)
+	{
+		try
+		{
+			flush();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	// capacity:
+
+	inline bool empty(void) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return tree.empty();
+	}
+
+	inline size_type size(void) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return tree.size();
+	}
+
+	inline size_type pending(void) const
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		return queue.size();
+	}
+
+	// Walks the tree in slices of slice_nodes ranks, each under its own
+	// shared lock, so a batch waits for one slice at most instead of a walk
+	// of the whole tree. Batches applied between slices make the result an
+	// approximation: nodes may be walked twice or skipped.
+	sb_tree_diagnostics diagnostics(size_type slice_nodes = 4096) const
+	{
+		if (!slice_nodes)
+			slice_nodes = 1;
+		sb_tree_diagnostics d;
+		{
+			std::shared_lock<std::shared_mutex> lock(tree_mutex);
+			d = tree.diagnostics_totals();
+		}
+		for (size_type first = 0;; first += slice_nodes)
+		{
+			std::shared_lock<std::shared_mutex> lock(tree_mutex);
+			if (tree.diagnostics(d, first, slice_nodes) < slice_nodes)
+				break;
+		}
+		sb_tree_finish_diagnostics(d);
+		return d;
+	}
+
+	// operations:
+
+	inline bool contains(const value_type& key) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return tree.find(key) != tree.end();
+	}
+
+	inline bool find(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return copy_if_valid(tree.find(key), value);
+	}
+
+	inline bool lower_bound(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return copy_if_valid(tree.lower_bound(key), value);
+	}
+
+	inline bool upper_bound(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return copy_if_valid(tree.upper_bound(key), value);
+	}
+
+	inline bool select(size_type idx, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return copy_if_valid(tree.select(idx), value);
+	}
+
+	inline size_type rank(const value_type& key) const
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return tree.rank(key);
+	}
+
+	// Calls f with the tree under the shared lock, for lookups that must see
+	// one consistent state.
+	template <class Function>
+	inline auto read(Function f) const -> decltype(f(std::declval<const tree_type&>()))
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return f(static_cast<const tree_type&>(tree));
+	}
+
+	// modifiers:
+
+	inline void insert_equal(const value_type& value)
+	{
+		push(operation::insert_equal, value);
+	}
+	inline void insert_equal(value_type&& value)
+	{
+		push(operation::insert_equal, std::forward<value_type>(value));
+	}
+
+	inline void insert_unique(const value_type& value)
+	{
+		push(operation::insert_unique, value);
+	}
+	inline void insert_unique(value_type&& value)
+	{
+		push(operation::insert_unique, std::forward<value_type>(value));
+	}
+
+	inline void erase(const value_type& key)
+	{
+		push(operation::erase, key);
+	}
+
+	// Applies the pending writes. If a write throws, the writes of its batch
+	// that were not applied yet are dropped and the exception propagates.
+	void flush(void)
+	{
+		// batches are applied one at a time and in the order they were queued
+		std::lock_guard<std::mutex> apply_lock(apply_mutex);
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			batch.swap(queue);
+		}
+		if (batch.empty())
+			return;
+		try
+		{
+			std::stable_sort(batch.begin(), batch.end(),
+				[this](const command& a, const command& b) { return comp(a.value, b.value); });
+			std::unique_lock<std::shared_mutex> lock(tree_mutex);
+			apply();
+		}
+		catch (...)
+		{
+			// the next flush swaps batch with the queue again
+			batch.clear();
+			throw;
+		}
+		batch.clear();
+	}
+
+	// Applies the pending writes, then calls f with the tree under the
+	// exclusive lock.
+	template <class Function>
+	inline auto write(Function f) -> decltype(f(std::declval<tree_type&>()))
+	{
+		flush();
+		std::unique_lock<std::shared_mutex> lock(tree_mutex);
+		return f(tree);
+	}
+
+private:
+	enum class operation : unsigned char
+	{
+		insert_equal,
+		insert_unique,
+		erase
+	};
+
+	struct command
+	{
+		operation  op;
+		value_type value;
+	};
+
+	inline bool copy_if_valid(const_iterator pos, value_type& value) const
+	{
+		if (pos == tree.end())
+			return false;
+		value = *pos;
+		return true;
+	}
+
+	template <class V>
+	void push(operation op, V&& value)
+	{
+		bool full;
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			queue.push_back(command{ op, std::forward<V>(value) });
+			full = queue.size() >= batch_size;
+		}
+		if (full)
+			flush();
+	}
+
+	void apply(void)
+	{
+		const tree_type& view = tree;
+		const_iterator hint = view.begin();
+		for (command& c : batch)
+		{
+			switch (c.op)
+			{
+			case operation::insert_equal:
+				hint = tree.insert_equal(hint, std::move(c.value));
+				break;
+			case operation::insert_unique:
+				hint = tree.insert_unique(hint, std::move(c.value));
+				break;
+			case operation::erase:
+				{
+					const_iterator first = view.lower_bound(hint, c.value);
+					const_iterator last = view.upper_bound(first, c.value);
+					hint = tree.erase(first, last);
+				}
+				break;
+			}
+		}
+	}
+
+private:
+	mutable std::shared_mutex tree_mutex;
+	mutable std::mutex        queue_mutex;
+	std::mutex                apply_mutex;
+	std::vector<command>      queue;
+	std::vector<command>      batch;
+	size_type                 batch_size;
+	tree_type                 tree;
+	compare_type              comp;
+};
+
+#endif
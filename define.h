@@ -39,4 +39,11 @@ static constexpr char SBT_NOT_INITIALIZED[] = "The SB-Tree is not initialized.";
 // out_of_range
 static constexpr char SBT_OUT_OF_RANGE[]    = "The index of SB-Tree is out of range.";
 
+// length_error
+static constexpr char SBT_NO_READER_SLOT[]  = "The SB-Tree has no free reader slot.";
+
+// runtime_error
+static constexpr char SBT_BAD_IMAGE[]       = "The SB-Tree image is invalid.";
+static constexpr char SBT_IO_FAILED[]       = "The SB-Tree stream operation failed.";
+
 #endif
@@ -0,0 +1,362 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_DURABLE_SB_TREE_H__
+#define __RULER_DURABLE_SB_TREE_H__
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "define.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Class template durable_sb_tree
+// Makes a sb_tree durable with a write-ahead log and checkpoints (POSIX).
+// Every modification is applied in memory and appended to a log buffer; the
+// buffer is written and synced once it holds group_size records (group
+// commit), or when commit() is called, so a modification is durable once
+// the commit that covers it has returned. A checkpoint saves the whole tree
+// to path.ckpt, replacing the previous one atomically, and empties the log
+// path.log. Recovery, done by the constructor, loads the checkpoint and
+// replays the log records that follow it, stopping at the first torn or
+// corrupt record.
+//
+// Every log record carries a sequence number, and the checkpoint stores the
+// last number it covers, so a crash between writing a checkpoint and
+// emptying the log does not replay a record twice. A commit that fails may
+// leave part of its records in the log; the next commit cuts the log back
+// to the end of the last successful one before writing them again, and
+// recovery skips any record whose number it has already replayed. The
+// elements must be trivially copyable.
+template <class Tree>
+class durable_sb_tree
+{
+public:
+	// types:
+
+	using tree_type  = Tree;
+	using value_type = typename Tree::value_type;
+	using size_type  = typename Tree::size_type;
+
+	static_assert(std::is_trivially_copyable<value_type>::value,
+		"durable_sb_tree requires a trivially copyable value_type.");
+
+	// construct/copy/destroy:
+
+	explicit durable_sb_tree(const std::string& path, size_type group_size = 256, size_type checkpoint_records = 1 << 20)
+		: log_path(path + ".log")
+		, checkpoint_path(path + ".ckpt")
+		, group(group_size ? group_size : 1)
+		, checkpoint_interval(checkpoint_records)
+		, log_fd(-1)
+		, next_lsn(1)
+		, logged(0)
+		, committed(0)
+		, unclean(false)
+	{
+		recover();
+		pending.reserve(group);
+	}
+
+	durable_sb_tree(const durable_sb_tree&) = delete;
+	durable_sb_tree& operator=(const durable_sb_tree&) = delete;
+
+	~durable_sb_tree(void)
+	{
+		try
+		{
+			commit();
+		}
+		catch (...)
+		{
+		}
+		if (log_fd >= 0)
+			::close(log_fd);
+	}
+
+	// observers:
+
+	inline const tree_type& tree(void) const noexcept
+	{
+		return data;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return data.size();
+	}
+
+	inline bool empty(void) const noexcept
+	{
+		return data.empty();
+	}
+
+	// Records not yet written and synced.
+	inline size_type pending_records(void) const noexcept
+	{
+		return pending.size();
+	}
+
+	// modifiers:
+
+	inline void insert_equal(const value_type& value)
+	{
+		data.insert_equal(value);
+		append(operation::insert_equal, value);
+	}
+
+	inline bool insert_unique(const value_type& value)
+	{
+		if (!data.insert_unique(value).second)
+			return false;
+		append(operation::insert_unique, value);
+		return true;
+	}
+
+	inline size_type erase(const value_type& key)
+	{
+		size_type n = data.erase(key);
+		if (n)
+			append(operation::erase, key);
+		return n;
+	}
+
+	// Writes and syncs the pending records.
+	void commit(void)
+	{
+		if (pending.empty())
+			return;
+		// drops what a failed commit may have written
+		if (unclean && ::ftruncate(log_fd, committed) != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		unclean = true;
+		write_all(log_fd, pending.data(), pending.size() * sizeof(record));
+		if (::fsync(log_fd) != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		unclean = false;
+		committed += static_cast<off_t>(pending.size() * sizeof(record));
+		logged += pending.size();
+		pending.clear();
+	}
+
+	// Saves the tree to a new checkpoint and empties the log.
+	void checkpoint(void)
+	{
+		commit();
+		std::string temp_path = checkpoint_path + ".tmp";
+		{
+			std::ofstream os(temp_path, std::ios::binary | std::ios::trunc);
+			checkpoint_header h;
+			std::memset(static_cast<void*>(&h), 0, sizeof(h));
+			std::memcpy(h.magic, "SBTC", 4);
+			h.lsn = next_lsn - 1;
+			os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+			data.save(os);
+			os.flush();
+			if (!os)
+				throw std::runtime_error(SBT_IO_FAILED);
+		}
+		sync_path(temp_path.c_str(), O_RDONLY);
+		if (std::rename(temp_path.c_str(), checkpoint_path.c_str()) != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		sync_path(directory().c_str(), O_RDONLY);
+		// the records up to h.lsn are covered by the checkpoint
+		if (::ftruncate(log_fd, 0) != 0 || ::fsync(log_fd) != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		committed = 0;
+		logged = 0;
+	}
+
+private:
+	enum class operation : uint32_t
+	{
+		insert_equal = 1,
+		insert_unique,
+		erase
+	};
+
+	struct record
+	{
+		uint64_t   lsn;
+		operation  op;
+		uint32_t   checksum;
+		value_type value;
+	};
+
+	struct checkpoint_header
+	{
+		char     magic[4];
+		uint32_t reserved;
+		uint64_t lsn;
+	};
+
+	// FNV-1a over the record bytes other than the checksum
+	static uint32_t checksum(const record& r) noexcept
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(&r);
+		const size_t skip = offsetof(record, checksum);
+		uint32_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(record); ++i)
+			if (i - skip >= sizeof(uint32_t))
+				h = (h ^ p[i]) * 16777619u;
+		return h;
+	}
+
+	void append(operation op, const value_type& value)
+	{
+		record r;
+		// no uninitialized padding in the log or the checksum
+		std::memset(static_cast<void*>(&r), 0, sizeof(r));
+		r.lsn = next_lsn++;
+		r.op = op;
+		r.value = value;
+		r.checksum = checksum(r);
+		pending.push_back(r);
+		if (pending.size() >= group)
+			commit();
+		if (checkpoint_interval && logged >= checkpoint_interval)
+			checkpoint();
+	}
+
+	void recover(void)
+	{
+		{
+			std::ifstream is(checkpoint_path, std::ios::binary);
+			if (is)
+			{
+				checkpoint_header h;
+				if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)) || std::memcmp(h.magic, "SBTC", 4))
+					throw std::runtime_error(SBT_BAD_IMAGE);
+				data.load(is);
+				next_lsn = h.lsn + 1;
+			}
+		}
+		log_fd = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (log_fd < 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		std::ifstream is(log_path, std::ios::binary);
+		off_t valid = 0;
+		record r;
+		while (is.read(reinterpret_cast<char*>(&r), sizeof(r)) && r.checksum == checksum(r))
+		{
+			// skips the records of the checkpoint and those written twice
+			if (r.lsn >= next_lsn)
+			{
+				replay(r);
+				next_lsn = r.lsn + 1;
+				++logged;
+			}
+			valid += sizeof(record);
+		}
+		// drops a torn tail so that new records follow the valid ones
+		if (::ftruncate(log_fd, valid) != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		committed = valid;
+	}
+
+	void replay(const record& r)
+	{
+		switch (r.op)
+		{
+		case operation::insert_equal:
+			data.insert_equal(r.value);
+			break;
+		case operation::insert_unique:
+			data.insert_unique(r.value);
+			break;
+		case operation::erase:
+			data.erase(r.value);
+			break;
+		default:
+			throw std::runtime_error(SBT_BAD_IMAGE);
+		}
+	}
+
+	static void write_all(int fd, const void* p, size_t n)
+	{
+		const char* bytes = static_cast<const char*>(p);
+		while (n)
+		{
+			ssize_t written = ::write(fd, bytes, n);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error(SBT_IO_FAILED);
+			}
+			bytes += written;
+			n -= static_cast<size_t>(written);
+		}
+	}
+
+	static void sync_path(const char* path, int flags)
+	{
+		int fd = ::open(path, flags);
+		if (fd < 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		int result = ::fsync(fd);
+		::close(fd);
+		if (result != 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+	inline std::string directory(void) const
+	{
+		std::string::size_type slash = checkpoint_path.rfind('/');
+		return slash == std::string::npos ? std::string(".") : checkpoint_path.substr(0, slash + 1);
+	}
+
+private:
+	std::string         log_path;
+	std::string         checkpoint_path;
+	size_type           group;
+	size_type           checkpoint_interval;
+	int                 log_fd;
+	uint64_t            next_lsn;
+	size_type           logged;
+	off_t               committed; // log size after the last successful commit
+	bool                unclean;   // the last commit failed
+	std::vector<record> pending;
+	tree_type           data;
+};
+
+#endif
+
+#endif
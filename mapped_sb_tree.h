@@ -0,0 +1,565 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_MAPPED_SB_TREE_H__
+#define __RULER_MAPPED_SB_TREE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "define.h"
+#include "sb_tree_image.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Struct template sb_tree_mapped_node
+// A node of a mapped image. The nodes are stored in preorder, so the left
+// child of a node is the next node and its right child follows the
+// left_size nodes of the left subtree. The image holds no pointers and can
+// be mapped at any address.
+template <class T>
+struct sb_tree_mapped_node
+{
+	uint64_t size;
+	uint64_t left_size;
+	T        data;
+
+	inline const sb_tree_mapped_node* left(void) const noexcept
+	{
+		return left_size ? this + 1 : nullptr;
+	}
+
+	inline const sb_tree_mapped_node* right(void) const noexcept
+	{
+		return size - left_size > 1 ? this + 1 + left_size : nullptr;
+	}
+};
+
+
+// Class template mapped_sb_tree_iterator
+// Keeps the path from the root; a perfectly balanced tree of less than 2^64
+// nodes is less than 64 levels deep.
+template <class T>
+class mapped_sb_tree_iterator
+{
+public:
+	// types:
+
+	using value_type         = T;
+	using pointer            = const T*;
+	using reference          = const T&;
+	using size_type          = size_t;
+	using difference_type    = ptrdiff_t;
+	using node_type          = sb_tree_mapped_node<T>;
+	using const_node_pointer = const node_type*;
+
+	using iterator_type      = mapped_sb_tree_iterator<T>;
+	using iterator_category  = std::bidirectional_iterator_tag;
+
+	static constexpr size_type max_depth = 64;
+
+	// construct/copy/destroy:
+
+	mapped_sb_tree_iterator(void) noexcept
+		: root(nullptr)
+		, depth(0)
+	{}
+	explicit mapped_sb_tree_iterator(const_node_pointer t) noexcept
+		: root(t)
+		, depth(0)
+	{}
+
+	// mapped_sb_tree_iterator operations:
+
+	inline const_node_pointer get_pointer(void) const noexcept
+	{
+		return depth ? path[depth - 1] : nullptr;
+	}
+
+	inline void push(const_node_pointer t) noexcept
+	{
+		path[depth++] = t;
+	}
+
+	inline void truncate(size_type n) noexcept
+	{
+		depth = n;
+	}
+
+	inline size_type get_depth(void) const noexcept
+	{
+		return depth;
+	}
+
+	inline reference operator*(void) const noexcept
+	{
+		return path[depth - 1]->data;
+	}
+
+	inline pointer operator->(void) const noexcept
+	{
+		return &(operator*());
+	}
+
+	// increment / decrement
+
+	iterator_type& operator++(void) noexcept
+	{
+		const_node_pointer node = path[depth - 1];
+		if (node->right())
+		{
+			for (node = node->right(); node; node = node->left())
+				push(node);
+		}
+		else
+		{
+			--depth;
+			while (depth && path[depth - 1]->right() == node)
+				node = path[--depth];
+		}
+		return *this;
+	}
+
+	iterator_type& operator--(void) noexcept
+	{
+		// the end iterator steps to the last node
+		if (!depth)
+		{
+			for (const_node_pointer node = root; node; node = node->right())
+				push(node);
+			return *this;
+		}
+		const_node_pointer node = path[depth - 1];
+		if (node->left())
+		{
+			for (node = node->left(); node; node = node->right())
+				push(node);
+		}
+		else
+		{
+			--depth;
+			while (depth && path[depth - 1]->left() == node)
+				node = path[--depth];
+		}
+		return *this;
+	}
+
+	inline iterator_type operator++(int) noexcept
+	{
+		iterator_type itr(*this);
+		this->operator++();
+		return itr;
+	}
+
+	inline iterator_type operator--(int) noexcept
+	{
+		iterator_type itr(*this);
+		this->operator--();
+		return itr;
+	}
+
+	// relational operators:
+
+	inline bool operator==(const iterator_type& rhs) const noexcept
+	{
+		return get_pointer() == rhs.get_pointer();
+	}
+
+	inline bool operator!=(const iterator_type& rhs) const noexcept
+	{
+		return get_pointer() != rhs.get_pointer();
+	}
+
+private:
+	const_node_pointer root;
+	const_node_pointer path[max_depth];
+	size_type          depth;
+};
+
+
+// Class template mapped_sb_tree
+// A read-only sb-tree over a position-independent image, typically a file
+// mapped into memory. Queries run directly on the image: nothing is
+// deserialized, pages are faulted in as they are touched, and processes that
+// map the same file share one copy in the page cache. The image is a
+// perfectly balanced tree in preorder, written by write().
+template <class T, class Compare = std::less<T>>
+class mapped_sb_tree
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+		"mapped_sb_tree requires a trivially copyable value_type.");
+
+public:
+	// types:
+
+	using compare_type       = Compare;
+	using value_type         = T;
+	using const_reference    = const T&;
+	using size_type          = size_t;
+	using difference_type    = ptrdiff_t;
+	using node_type          = sb_tree_mapped_node<T>;
+	using const_node_pointer = const node_type*;
+
+	using const_iterator         = mapped_sb_tree_iterator<T>;
+	using iterator               = const_iterator;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+	using reverse_iterator       = const_reverse_iterator;
+
+	// Offset of the first node from the start of the image.
+	static constexpr size_type node_offset =
+		(sizeof(sb_tree_image_header) + alignof(node_type) - 1) / alignof(node_type) * alignof(node_type);
+
+	// construct/copy/destroy:
+
+	mapped_sb_tree(void) noexcept
+		: comp()
+		, root(nullptr)
+		, count(0)
+	{}
+
+	// The image must stay mapped while the tree is used. Every node is read
+	// once to check that the image has the shape write() gives it.
+	mapped_sb_tree(const void* image, size_type bytes, const compare_type& compare = compare_type())
+		: comp(compare)
+		, root(nullptr)
+		, count(0)
+	{
+		const sb_tree_image_header* h = static_cast<const sb_tree_image_header*>(image);
+		if (bytes < node_offset || !h->valid() || !(h->flags & sb_tree_image_mapped) ||
+			h->element_size != sizeof(node_type) || h->count > (bytes - node_offset) / sizeof(node_type) ||
+			reinterpret_cast<uintptr_t>(image) % alignof(node_type))
+			throw std::runtime_error(SBT_BAD_IMAGE);
+		count = static_cast<size_type>(h->count);
+		if (count)
+		{
+			root = reinterpret_cast<const_node_pointer>(static_cast<const char*>(image) + node_offset);
+			if (!valid_shape(root, count))
+				throw std::runtime_error(SBT_BAD_IMAGE);
+		}
+	}
+
+	// Writes the image of the sorted range [first, last).
+	template <class InputIt>
+	static void write(std::ostream& os, InputIt first, InputIt last)
+	{
+		std::vector<value_type> elements(first, last);
+		sb_tree_image_header h;
+		h.init(sb_tree_image_mapped, sizeof(node_type), elements.size());
+		char padding[node_offset] = {};
+		os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		os.write(padding, node_offset - sizeof(h));
+		std::vector<node_type> block;
+		block.reserve(io_block);
+		if (!elements.empty())
+			write_subtree(os, block, elements.data(), elements.size());
+		os.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(node_type));
+		if (!os)
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+	// iterators:
+
+	const_iterator begin(void) const noexcept
+	{
+		const_iterator it(root);
+		for (const_node_pointer t = root; t; t = t->left())
+			it.push(t);
+		return it;
+	}
+	inline const_iterator cbegin(void) const noexcept
+	{
+		return begin();
+	}
+
+	inline const_iterator end(void) const noexcept
+	{
+		return const_iterator(root);
+	}
+	inline const_iterator cend(void) const noexcept
+	{
+		return end();
+	}
+
+	inline const_reverse_iterator rbegin(void) const noexcept
+	{
+		return const_reverse_iterator(end());
+	}
+	inline const_reverse_iterator crbegin(void) const noexcept
+	{
+		return rbegin();
+	}
+
+	inline const_reverse_iterator rend(void) const noexcept
+	{
+		return const_reverse_iterator(begin());
+	}
+	inline const_reverse_iterator crend(void) const noexcept
+	{
+		return rend();
+	}
+
+	// capacity:
+
+	inline bool empty(void) const noexcept
+	{
+		return !count;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return count;
+	}
+
+	// element access:
+
+	inline const_reference operator[](size_type pos) const noexcept
+	{
+		return *select(pos);
+	}
+
+	inline const_reference at(size_type pos) const
+	{
+		if (pos >= size())
+			throw std::out_of_range(SBT_OUT_OF_RANGE);
+		return *select(pos);
+	}
+
+	// operations:
+
+	inline const_iterator find(const value_type& key) const noexcept
+	{
+		const_iterator pos = lower_bound(key);
+		if (pos != end() && comp(key, *pos))
+			return end();
+		return pos;
+	}
+
+	const_iterator lower_bound(const value_type& key) const noexcept
+	{
+		const_iterator it(root);
+		size_type depth = 0;
+		for (const_node_pointer t = root; t; )
+		{
+			it.push(t);
+			if (!comp(t->data, key))
+			{
+				depth = it.get_depth();
+				t = t->left();
+			}
+			else
+				t = t->right();
+		}
+		it.truncate(depth);
+		return it;
+	}
+
+	const_iterator upper_bound(const value_type& key) const noexcept
+	{
+		const_iterator it(root);
+		size_type depth = 0;
+		for (const_node_pointer t = root; t; )
+		{
+			it.push(t);
+			if (comp(key, t->data))
+			{
+				depth = it.get_depth();
+				t = t->left();
+			}
+			else
+				t = t->right();
+		}
+		it.truncate(depth);
+		return it;
+	}
+
+	const_iterator select(size_type idx) const noexcept
+	{
+		const_iterator it(root);
+		const_node_pointer t = root;
+		while (t)
+		{
+			it.push(t);
+			if (t->left_size < idx)
+			{
+				idx -= (t->left_size + 1);
+				t = t->right();
+			}
+			else if (idx < t->left_size)
+				t = t->left();
+			else
+				return it;
+		}
+		return end();
+	}
+
+	size_type rank(const value_type& key) const noexcept
+	{
+		size_type rank = 0;
+		const_node_pointer pre = nullptr;
+		for (const_node_pointer t = root; t; )
+		{
+			if (!comp(t->data, key))
+			{
+				pre = t;
+				t = t->left();
+			}
+			else
+			{
+				rank += t->left_size + 1;
+				t = t->right();
+			}
+		}
+		if (!pre || comp(key, pre->data))
+			rank = static_cast<size_type>(-1);
+		return rank;
+	}
+
+private:
+	// nodes per write
+	static constexpr size_type io_block = 65536;
+
+	// Tells whether the n nodes from t are the preorder of a perfectly
+	// balanced tree, as written by write_subtree, so that no child offset
+	// leaves them and no path is deeper than the iterator can hold.
+	static bool valid_shape(const_node_pointer t, size_type n) noexcept
+	{
+		// the sizes of the right subtrees still to check, innermost last
+		size_type pending[const_iterator::max_depth];
+		size_type depth = 0;
+		for (;;)
+		{
+			if (t->size != n || t->left_size != n / 2)
+				return false;
+			if (n - n / 2 - 1)
+			{
+				if (depth == const_iterator::max_depth)
+					return false;
+				pending[depth++] = n - n / 2 - 1;
+			}
+			++t;
+			if (n / 2)
+				n /= 2;
+			else if (depth)
+				n = pending[--depth];
+			else
+				return true;
+		}
+	}
+
+	static void write_subtree(std::ostream& os, std::vector<node_type>& block, const value_type* first, size_type n)
+	{
+		size_type mid = n / 2;
+		node_type node;
+		// no uninitialized padding in the image
+		std::memset(static_cast<void*>(&node), 0, sizeof(node));
+		node.size = n;
+		node.left_size = mid;
+		node.data = first[mid];
+		block.push_back(node);
+		if (block.size() == io_block)
+		{
+			os.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(node_type));
+			block.clear();
+		}
+		if (mid)
+			write_subtree(os, block, first, mid);
+		if (n - mid - 1)
+			write_subtree(os, block, first + mid + 1, n - mid - 1);
+	}
+
+private:
+	compare_type       comp;
+	const_node_pointer root;
+	size_type          count;
+};
+
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Class sb_tree_file_mapping
+// Maps a file read-only and shared, so that every process mapping it uses
+// the same pages of the page cache.
+class sb_tree_file_mapping
+{
+public:
+	explicit sb_tree_file_mapping(const char* path)
+		: data(nullptr)
+		, bytes(0)
+	{
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(SBT_IO_FAILED);
+		struct stat st;
+		if (::fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			bytes = static_cast<size_t>(st.st_size);
+			data = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		::close(fd);
+		if (!data || data == MAP_FAILED)
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+	sb_tree_file_mapping(const sb_tree_file_mapping&) = delete;
+	sb_tree_file_mapping& operator=(const sb_tree_file_mapping&) = delete;
+
+	~sb_tree_file_mapping(void)
+	{
+		::munmap(data, bytes);
+	}
+
+	inline const void* get(void) const noexcept
+	{
+		return data;
+	}
+
+	inline size_t size(void) const noexcept
+	{
+		return bytes;
+	}
+
+private:
+	void*  data;
+	size_t bytes;
+};
+
+#endif
+
+#endif
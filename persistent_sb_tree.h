@@ -0,0 +1,610 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_PERSISTENT_SB_TREE_H__
+#define __RULER_PERSISTENT_SB_TREE_H__
+
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "define.h"
+#include "sb_tree_path_copy.h"
+
+#ifndef DEFAULT_ALLOCATOR
+#define DEFAULT_ALLOCATOR(T) std::allocator<T>
+#endif // !DEFAULT_ALLOCATOR
+
+// Class template persistent_sb_tree_iterator
+// Nodes of a persistent tree have no parent pointer, so the iterator keeps
+// the path from the root to its node.
+template <class T>
+class persistent_sb_tree_iterator
+{
+public:
+	// types:
+
+	using value_type         = T;
+	using pointer            = const T*;
+	using reference          = const T&;
+	using size_type          = size_t;
+	using difference_type    = ptrdiff_t;
+	using node_type          = sb_tree_shared_node<T>;
+	using const_node_pointer = const node_type*;
+
+	using iterator_type      = persistent_sb_tree_iterator<T>;
+	using iterator_category  = std::bidirectional_iterator_tag;
+
+	// construct/copy/destroy:
+
+	persistent_sb_tree_iterator(void) noexcept
+		: root(nullptr)
+	{}
+	persistent_sb_tree_iterator(const_node_pointer t, std::vector<const_node_pointer>&& p) noexcept
+		: root(t)
+		, path(std::move(p))
+	{}
+
+	// persistent_sb_tree_iterator operations:
+
+	inline const_node_pointer get_pointer(void) const noexcept
+	{
+		return path.empty() ? nullptr : path.back();
+	}
+
+	inline reference operator*(void) const noexcept
+	{
+		return path.back()->data;
+	}
+
+	inline pointer operator->(void) const noexcept
+	{
+		return &(operator*());
+	}
+
+	// increment / decrement
+
+	iterator_type& operator++(void)
+	{
+		const_node_pointer node = path.back();
+		if (node->right)
+		{
+			for (node = node->right; node; node = node->left)
+				path.push_back(node);
+		}
+		else
+		{
+			path.pop_back();
+			while (!path.empty() && path.back()->right == node)
+			{
+				node = path.back();
+				path.pop_back();
+			}
+		}
+		return *this;
+	}
+
+	iterator_type& operator--(void)
+	{
+		// the end iterator steps to the rightmost node
+		if (path.empty())
+		{
+			for (const_node_pointer node = root; node; node = node->right)
+				path.push_back(node);
+			return *this;
+		}
+		const_node_pointer node = path.back();
+		if (node->left)
+		{
+			for (node = node->left; node; node = node->right)
+				path.push_back(node);
+		}
+		else
+		{
+			path.pop_back();
+			while (!path.empty() && path.back()->left == node)
+			{
+				node = path.back();
+				path.pop_back();
+			}
+		}
+		return *this;
+	}
+
+	inline iterator_type operator++(int)
+	{
+		iterator_type itr(*this);
+		this->operator++();
+		return itr;
+	}
+
+	inline iterator_type operator--(int)
+	{
+		iterator_type itr(*this);
+		this->operator--();
+		return itr;
+	}
+
+	// relational operators:
+
+	inline bool operator==(const iterator_type& rhs) const noexcept
+	{
+		return get_pointer() == rhs.get_pointer();
+	}
+
+	inline bool operator!=(const iterator_type& rhs) const noexcept
+	{
+		return get_pointer() != rhs.get_pointer();
+	}
+
+private:
+	const_node_pointer              root;
+	std::vector<const_node_pointer> path;
+};
+
+
+// Class template persistent_sb_tree
+// A fully persistent Size-Balanced Tree. Copying a tree is O(1) and yields an
+// independent version that shares all the nodes of the original. An update
+// path-copies the O(log n) nodes it changes, so every other version keeps
+// its contents, and only those nodes are allocated.
+//
+// All the versions derived from one tree share an arena. Nodes replaced by
+// an update are kept until the last version sharing the arena is destroyed;
+// compact() moves a version into an arena of its own. Versions may be read
+// from any number of threads; updates to versions sharing an arena are
+// serialized by the arena lock.
+template <class T, class Compare = std::less<T>, class Allocator = DEFAULT_ALLOCATOR(T)>
+class persistent_sb_tree
+{
+public:
+	// types:
+
+	using compare_type        = Compare;
+	using tree_type           = persistent_sb_tree<T, Compare, Allocator>;
+	using value_type          = T;
+	using reference           = value_type&;
+	using const_reference     = const value_type&;
+	using size_type           = size_t;
+	using difference_type     = ptrdiff_t;
+	using node_type           = sb_tree_shared_node<T>;
+	using node_pointer        = node_type*;
+	using const_node_pointer  = const node_type*;
+	using tree_traits_type    = std::allocator_traits<Allocator>;
+	using allocator_type      = typename tree_traits_type::template rebind_alloc<T>;
+	using traits_type         = typename tree_traits_type::template rebind_traits<T>;
+	using node_allocator_type = typename tree_traits_type::template rebind_alloc<node_type>;
+	using node_traits_type    = typename tree_traits_type::template rebind_traits<node_type>;
+
+	using iterator               = persistent_sb_tree_iterator<T>;
+	using const_iterator         = persistent_sb_tree_iterator<T>;
+	using reverse_iterator       = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+private:
+	// Node storage shared by a family of versions. Nodes are carved from
+	// blocks; nodes discarded by an update are reused, and a node on the free
+	// list is marked by a zero size.
+	class arena
+	{
+	public:
+		static constexpr size_type block_nodes = 256;
+
+		// serializes the updates of all the versions sharing the arena
+		std::mutex mutex;
+		// stamp of the nodes created by the current update
+		uint64_t   stamp;
+
+		explicit arena(const allocator_type& alloc)
+			: stamp(0)
+			, allocator(alloc)
+			, node_alloc(alloc)
+			, free_list(nullptr)
+			, used(block_nodes)
+		{}
+
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		~arena(void)
+		{
+			for (size_type i = 0; i < blocks.size(); ++i)
+			{
+				size_type n = i + 1 == blocks.size() ? used : block_nodes;
+				for (size_type j = 0; j < n; ++j)
+				{
+					if (blocks[i][j].size)
+						traits_type::destroy(allocator, std::addressof(blocks[i][j].data));
+				}
+				node_traits_type::deallocate(node_alloc, blocks[i], block_nodes);
+			}
+		}
+
+		inline allocator_type get_allocator(void) const
+		{
+			return allocator;
+		}
+
+		// Manager interface of sb_tree_path_copy.
+
+		template <class ...Args>
+		node_pointer create(uint64_t s, Args&&... args)
+		{
+			node_pointer p = allocate();
+			try
+			{
+				traits_type::construct(allocator, std::addressof(p->data), std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				release(p);
+				throw;
+			}
+			p->size = 1;
+			p->stamp = s;
+			return p;
+		}
+
+		node_pointer clone(uint64_t s, const_node_pointer t)
+		{
+			node_pointer p = create(s, t->data);
+			p->left = t->left;
+			p->right = t->right;
+			p->size = t->size;
+			return p;
+		}
+
+		// older versions may still reach it
+		inline void retire(node_pointer) noexcept
+		{}
+
+		inline void discard(node_pointer p)
+		{
+			traits_type::destroy(allocator, std::addressof(p->data));
+			release(p);
+		}
+
+	private:
+		node_pointer allocate(void)
+		{
+			if (free_list)
+			{
+				node_pointer p = free_list;
+				free_list = p->left;
+				return p;
+			}
+			if (used == block_nodes)
+			{
+				blocks.reserve(blocks.size() + 1);
+				blocks.push_back(node_traits_type::allocate(node_alloc, block_nodes));
+				used = 0;
+			}
+			return blocks.back() + used++;
+		}
+
+		inline void release(node_pointer p) noexcept
+		{
+			p->size = 0;
+			p->left = free_list;
+			free_list = p;
+		}
+
+	private:
+		allocator_type            allocator;
+		node_allocator_type       node_alloc;
+		std::vector<node_pointer> blocks;
+		node_pointer              free_list;
+		size_type                 used;
+	};
+
+	using path_copy_type = sb_tree_path_copy<T, Compare, arena>;
+
+public:
+	// construct/copy/destroy:
+
+	explicit persistent_sb_tree(const compare_type& compare = compare_type(), const Allocator& alloc = Allocator())
+		: comp(compare)
+		, storage(std::make_shared<arena>(alloc))
+		, root(nullptr)
+	{}
+
+	persistent_sb_tree(std::initializer_list<T> ilist, const compare_type& compare = compare_type(), const Allocator& alloc = Allocator())
+		: persistent_sb_tree(compare, alloc)
+	{
+		insert_equal(ilist.begin(), ilist.end());
+	}
+
+	// Copies share all the nodes of other.
+	persistent_sb_tree(const tree_type& other) = default;
+	persistent_sb_tree(tree_type&& other) = default;
+	tree_type& operator=(const tree_type& other) = default;
+	tree_type& operator=(tree_type&& other) = default;
+
+	// iterators:
+
+	inline const_iterator begin(void) const
+	{
+		std::vector<const_node_pointer> path;
+		for (const_node_pointer t = root; t; t = t->left)
+			path.push_back(t);
+		return const_iterator(root, std::move(path));
+	}
+	inline const_iterator cbegin(void) const
+	{
+		return begin();
+	}
+
+	inline const_iterator end(void) const
+	{
+		return const_iterator(root, std::vector<const_node_pointer>());
+	}
+	inline const_iterator cend(void) const
+	{
+		return end();
+	}
+
+	inline const_reverse_iterator rbegin(void) const
+	{
+		return const_reverse_iterator(end());
+	}
+	inline const_reverse_iterator crbegin(void) const
+	{
+		return rbegin();
+	}
+
+	inline const_reverse_iterator rend(void) const
+	{
+		return const_reverse_iterator(begin());
+	}
+	inline const_reverse_iterator crend(void) const
+	{
+		return rend();
+	}
+
+	// capacity:
+
+	inline bool empty(void) const noexcept
+	{
+		return !root;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return root ? root->size : 0;
+	}
+
+	// observers:
+
+	inline compare_type compare(void) const
+	{
+		return comp;
+	}
+
+	// element access:
+
+	inline const_reference operator[](size_type pos) const noexcept
+	{
+		return path_copy_type::select(root, pos)->data;
+	}
+
+	inline const_reference at(size_type pos) const
+	{
+		if (pos >= size())
+			throw std::out_of_range(SBT_OUT_OF_RANGE);
+		return path_copy_type::select(root, pos)->data;
+	}
+
+	// modifiers:
+
+	template <class... Args>
+	inline void emplace_equal(Args&&... args)
+	{
+		std::lock_guard<std::mutex> lock(storage->mutex);
+		path_copy_type updater(*storage, comp, ++storage->stamp);
+		root = updater.insert_equal(root, std::forward<Args>(args)...);
+	}
+
+	inline void insert_equal(const value_type& value)
+	{
+		emplace_equal(value);
+	}
+	inline void insert_equal(value_type&& value)
+	{
+		emplace_equal(std::forward<value_type>(value));
+	}
+
+	template <class InputIt>
+	inline void insert_equal(InputIt first, InputIt last)
+	{
+		std::lock_guard<std::mutex> lock(storage->mutex);
+		// one stamp, so the nodes copied by the first insertions are reused
+		path_copy_type updater(*storage, comp, ++storage->stamp);
+		for (; first != last; ++first)
+			root = updater.insert_equal(root, *first);
+	}
+
+	inline bool insert_unique(const value_type& value)
+	{
+		if (path_copy_type::find(comp, root, value))
+			return false;
+		emplace_equal(value);
+		return true;
+	}
+	inline bool insert_unique(value_type&& value)
+	{
+		if (path_copy_type::find(comp, root, value))
+			return false;
+		emplace_equal(std::forward<value_type>(value));
+		return true;
+	}
+
+	size_type erase(const value_type& key)
+	{
+		size_type n = 0;
+		if (path_copy_type::find(comp, root, key))
+		{
+			std::lock_guard<std::mutex> lock(storage->mutex);
+			path_copy_type updater(*storage, comp, ++storage->stamp);
+			do
+			{
+				root = updater.erase(root, key);
+				++n;
+			} while (path_copy_type::find(comp, root, key));
+		}
+		return n;
+	}
+
+	inline void swap(tree_type& rhs) noexcept
+	{
+		using std::swap;
+		swap(comp, rhs.comp);
+		storage.swap(rhs.storage);
+		swap(root, rhs.root);
+	}
+
+	// Drops this version's reference to the shared nodes.
+	inline void clear(void)
+	{
+		root = nullptr;
+	}
+
+	// Moves this version into an arena of its own, so that the nodes only
+	// reachable from other versions can be freed with them.
+	void compact(void)
+	{
+		std::vector<const_node_pointer> nodes;
+		nodes.reserve(size());
+		for (const_iterator it = begin(); it != end(); ++it)
+			nodes.push_back(it.get_pointer());
+		std::shared_ptr<arena> fresh = std::make_shared<arena>(storage->get_allocator());
+		root = build(*fresh, nodes.data(), nodes.size());
+		storage.swap(fresh);
+	}
+
+	// operations:
+
+	inline const_iterator find(const value_type& key) const
+	{
+		const_iterator pos = lower_bound(key);
+		if (pos != end() && comp(key, *pos))
+			return end();
+		return pos;
+	}
+
+	const_iterator lower_bound(const value_type& key) const
+	{
+		std::vector<const_node_pointer> path;
+		size_type depth = 0;
+		for (const_node_pointer t = root; t; )
+		{
+			path.push_back(t);
+			if (!comp(t->data, key))
+			{
+				depth = path.size();
+				t = t->left;
+			}
+			else
+				t = t->right;
+		}
+		path.resize(depth);
+		return const_iterator(root, std::move(path));
+	}
+
+	const_iterator upper_bound(const value_type& key) const
+	{
+		std::vector<const_node_pointer> path;
+		size_type depth = 0;
+		for (const_node_pointer t = root; t; )
+		{
+			path.push_back(t);
+			if (comp(key, t->data))
+			{
+				depth = path.size();
+				t = t->left;
+			}
+			else
+				t = t->right;
+		}
+		path.resize(depth);
+		return const_iterator(root, std::move(path));
+	}
+
+	const_iterator select(size_type idx) const
+	{
+		std::vector<const_node_pointer> path;
+		const_node_pointer t = root;
+		while (t)
+		{
+			path.push_back(t);
+			size_type left_size = t->left ? t->left->size : 0;
+			if (left_size < idx)
+			{
+				t = t->right;
+				idx -= (left_size + 1);
+			}
+			else if (idx < left_size)
+				t = t->left;
+			else
+				return const_iterator(root, std::move(path));
+		}
+		return end();
+	}
+
+	inline size_type rank(const value_type& key) const
+	{
+		return path_copy_type::rank(comp, root, key);
+	}
+
+private:
+	// Builds a perfectly balanced tree, which satisfies the SBT properties,
+	// from the n nodes in order.
+	static node_pointer build(arena& a, const const_node_pointer* nodes, size_type n)
+	{
+		if (!n)
+			return nullptr;
+		size_type mid = n / 2;
+		node_pointer t = a.create(0, nodes[mid]->data);
+		t->left = build(a, nodes, mid);
+		t->right = build(a, nodes + mid + 1, n - mid - 1);
+		t->size = n;
+		return t;
+	}
+
+private:
+	compare_type           comp;
+	std::shared_ptr<arena> storage;
+	node_pointer           root;
+};
+
+#endif
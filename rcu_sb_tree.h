@@ -0,0 +1,492 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_RCU_SB_TREE_H__
+#define __RULER_RCU_SB_TREE_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <vector>
+#include "define.h"
+#include "sb_tree_path_copy.h"
+
+#ifndef DEFAULT_ALLOCATOR
+#define DEFAULT_ALLOCATOR(T) std::allocator<T>
+#endif // !DEFAULT_ALLOCATOR
+
+// Class template rcu_sb_tree
+// A Size-Balanced Tree with one writer thread and any number of reader
+// threads that never block. The writer builds each new version by path
+// copying, so the nodes that readers may be traversing are never modified,
+// and publishes it with a single store of the root pointer. Nodes replaced by
+// an update are reclaimed by epochs: each reader announces the epoch in which
+// it started reading, and the writer frees a node once every reader that
+// might still hold it has left.
+//
+// Readers work through a reader handle, one per thread. A lookup performs
+// one store and one fence to announce itself and one store to leave; it does
+// no atomic read-modify-write and takes no lock. All the modifiers, clear and
+// synchronize must be called from the same writer thread.
+template <class T, class Compare = std::less<T>, class Allocator = DEFAULT_ALLOCATOR(T)>
+class rcu_sb_tree
+{
+public:
+	// types:
+
+	using compare_type        = Compare;
+	using tree_type           = rcu_sb_tree<T, Compare, Allocator>;
+	using value_type          = T;
+	using size_type           = size_t;
+	using node_type           = sb_tree_shared_node<T>;
+	using node_pointer        = node_type*;
+	using const_node_pointer  = const node_type*;
+	using tree_traits_type    = std::allocator_traits<Allocator>;
+	using allocator_type      = typename tree_traits_type::template rebind_alloc<T>;
+	using traits_type         = typename tree_traits_type::template rebind_traits<T>;
+	using node_allocator_type = typename tree_traits_type::template rebind_alloc<node_type>;
+	using node_traits_type    = typename tree_traits_type::template rebind_traits<node_type>;
+	using path_copy_type      = sb_tree_path_copy<T, Compare, tree_type>;
+
+	friend path_copy_type;
+
+private:
+	static constexpr uint64_t idle_epoch = 0;
+
+	struct alignas(64) reader_slot
+	{
+		std::atomic<uint64_t> epoch;
+		std::atomic<bool>     claimed;
+	};
+
+public:
+	// Class reader
+	// The handle through which one thread reads the tree.
+	class reader
+	{
+	public:
+		reader(reader&& other) noexcept
+			: tree(other.tree)
+			, slot(other.slot)
+		{
+			other.slot = nullptr;
+		}
+
+		reader(const reader&) = delete;
+		reader& operator=(const reader&) = delete;
+
+		~reader(void)
+		{
+			if (slot)
+				slot->claimed.store(false, std::memory_order_release);
+		}
+
+		inline size_type size(void) const
+		{
+			guard g(*this);
+			return g.root ? g.root->size : 0;
+		}
+
+		inline bool contains(const value_type& key) const
+		{
+			guard g(*this);
+			return path_copy_type::find(tree->comp, g.root, key) != nullptr;
+		}
+
+		inline bool find(const value_type& key, value_type& value) const
+		{
+			guard g(*this);
+			return copy_if_valid(path_copy_type::find(tree->comp, g.root, key), value);
+		}
+
+		inline bool lower_bound(const value_type& key, value_type& value) const
+		{
+			guard g(*this);
+			return copy_if_valid(path_copy_type::lower_bound(tree->comp, g.root, key), value);
+		}
+
+		inline bool upper_bound(const value_type& key, value_type& value) const
+		{
+			guard g(*this);
+			return copy_if_valid(path_copy_type::upper_bound(tree->comp, g.root, key), value);
+		}
+
+		inline bool select(size_type idx, value_type& value) const
+		{
+			guard g(*this);
+			return copy_if_valid(path_copy_type::select(g.root, idx), value);
+		}
+
+		inline size_type rank(const value_type& key) const
+		{
+			guard g(*this);
+			return path_copy_type::rank(tree->comp, g.root, key);
+		}
+
+	private:
+		friend class rcu_sb_tree;
+
+		reader(const tree_type* owner, reader_slot* s) noexcept
+			: tree(owner)
+			, slot(s)
+		{}
+
+		// Announces the epoch of the reader for the duration of one lookup.
+		struct guard
+		{
+			explicit guard(const reader& r) noexcept
+				: slot(r.slot)
+			{
+				slot->epoch.store(r.tree->global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				root = r.tree->root.load(std::memory_order_acquire);
+			}
+
+			~guard(void)
+			{
+				slot->epoch.store(idle_epoch, std::memory_order_release);
+			}
+
+			reader_slot*       slot;
+			const_node_pointer root;
+		};
+
+		static inline bool copy_if_valid(const_node_pointer n, value_type& value)
+		{
+			if (!n)
+				return false;
+			value = n->data;
+			return true;
+		}
+
+		const tree_type* tree;
+		reader_slot*     slot;
+	};
+
+	// construct/copy/destroy:
+
+	explicit rcu_sb_tree(size_type max_readers = 64, const compare_type& compare = compare_type(), const Allocator& alloc = Allocator())
+		: comp(compare)
+		, allocator(alloc)
+		, node_alloc(alloc)
+		, root(nullptr)
+		, global_epoch(1)
+		, stamp(0)
+		, count(0)
+		, slot_count(max_readers ? max_readers : 1)
+		, slots(new reader_slot[slot_count])
+	{
+		for (size_type i = 0; i < slot_count; ++i)
+		{
+			slots[i].epoch.store(idle_epoch, std::memory_order_relaxed);
+			slots[i].claimed.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	rcu_sb_tree(const tree_type&) = delete;
+	tree_type& operator=(const tree_type&) = delete;
+
+	// All the readers must have been destroyed.
+	~rcu_sb_tree(void)
+	{
+		destroy_subtree(root.load(std::memory_order_relaxed));
+		for (auto& r : retired)
+			destroy_node(r.second);
+	}
+
+	// readers:
+
+	// Claims a reader slot for the calling thread.
+	reader make_reader(void)
+	{
+		for (size_type i = 0; i < slot_count; ++i)
+		{
+			bool expected = false;
+			if (!slots[i].claimed.load(std::memory_order_relaxed) &&
+				slots[i].claimed.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+				return reader(this, &slots[i]);
+		}
+		throw std::length_error(SBT_NO_READER_SLOT);
+	}
+
+	// capacity (writer thread):
+
+	inline bool empty(void) const noexcept
+	{
+		return count == 0;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return count;
+	}
+
+	// modifiers (writer thread):
+
+	template <class... Args>
+	inline void emplace_equal(Args&&... args)
+	{
+		path_copy_type updater(*this, comp, ++stamp);
+		publish(build([&] {
+			return updater.insert_equal(root.load(std::memory_order_relaxed), std::forward<Args>(args)...);
+		}));
+		++count;
+	}
+
+	inline void insert_equal(const value_type& value)
+	{
+		emplace_equal(value);
+	}
+	inline void insert_equal(value_type&& value)
+	{
+		emplace_equal(std::forward<value_type>(value));
+	}
+
+	inline bool insert_unique(const value_type& value)
+	{
+		if (path_copy_type::find(comp, root.load(std::memory_order_relaxed), value))
+			return false;
+		emplace_equal(value);
+		return true;
+	}
+	inline bool insert_unique(value_type&& value)
+	{
+		if (path_copy_type::find(comp, root.load(std::memory_order_relaxed), value))
+			return false;
+		emplace_equal(std::forward<value_type>(value));
+		return true;
+	}
+
+	// Erases all the elements equivalent to key in one update.
+	size_type erase(const value_type& key)
+	{
+		node_pointer t = root.load(std::memory_order_relaxed);
+		size_type n = 0;
+		if (path_copy_type::find(comp, t, key))
+		{
+			path_copy_type updater(*this, comp, ++stamp);
+			publish(build([&] {
+				do
+				{
+					t = updater.erase(t, key);
+					++n;
+				} while (path_copy_type::find(comp, t, key));
+				return t;
+			}));
+			count -= n;
+		}
+		return n;
+	}
+
+	void clear(void)
+	{
+		node_pointer t = root.load(std::memory_order_relaxed);
+		if (t)
+		{
+			// the whole tree is retired at once; reserved first, so that no
+			// node of the live tree is left pending if collecting throws
+			pending.reserve(pending.size() + count);
+			collect(t);
+			publish(nullptr);
+			count = 0;
+		}
+	}
+
+	// Waits until no reader can hold a retired node and frees all of them.
+	void synchronize(void)
+	{
+		while (!retired.empty())
+			reclaim();
+	}
+
+private:
+	// node management, used by sb_tree_path_copy:
+
+	template <class ...Args>
+	node_pointer create(uint64_t s, Args&&... args)
+	{
+		node_pointer p = node_traits_type::allocate(node_alloc, 1);
+		try
+		{
+			traits_type::construct(allocator, std::addressof(p->data), std::forward<Args>(args)...);
+		}
+		catch (...)
+		{
+			node_traits_type::deallocate(node_alloc, p, 1);
+			throw;
+		}
+		try
+		{
+			created.push_back(p);
+		}
+		catch (...)
+		{
+			destroy_node(p);
+			throw;
+		}
+		p->stamp = s;
+		return p;
+	}
+
+	node_pointer clone(uint64_t s, const_node_pointer t)
+	{
+		node_pointer p = create(s, t->data);
+		p->left = t->left;
+		p->right = t->right;
+		p->size = t->size;
+		return p;
+	}
+
+	inline void retire(node_pointer t)
+	{
+		staged.push_back(t);
+	}
+
+	// freed when the update completes, so that a failed update frees each
+	// node it created exactly once
+	inline void discard(node_pointer t)
+	{
+		discarded.push_back(t);
+	}
+
+	// Runs one update, which returns the root of the new version. The nodes
+	// of the published version that it replaces are staged, and only handed
+	// to the next publish once the new root is built: until then they are
+	// still reachable. If the update throws, the nodes it created are freed
+	// and the published version and the retired nodes are left as they were.
+	template <class Update>
+	node_pointer build(Update update)
+	{
+		node_pointer t;
+		try
+		{
+			t = update();
+			pending.reserve(pending.size() + staged.size());
+			pending.insert(pending.end(), staged.begin(), staged.end());
+		}
+		catch (...)
+		{
+			for (node_pointer p : created)
+				destroy_node(p);
+			created.clear();
+			discarded.clear();
+			staged.clear();
+			throw;
+		}
+		for (node_pointer p : discarded)
+			destroy_node(p);
+		created.clear();
+		discarded.clear();
+		staged.clear();
+		return t;
+	}
+
+	inline void destroy_node(node_pointer p)
+	{
+		traits_type::destroy(allocator, std::addressof(p->data));
+		node_traits_type::deallocate(node_alloc, p, 1);
+	}
+
+	void destroy_subtree(node_pointer t)
+	{
+		while (t)
+		{
+			destroy_subtree(t->right);
+			node_pointer left = t->left;
+			destroy_node(t);
+			t = left;
+		}
+	}
+
+	void collect(node_pointer t)
+	{
+		while (t)
+		{
+			collect(t->right);
+			pending.push_back(t);
+			t = t->left;
+		}
+	}
+
+	// Publishes a new root, tags the nodes it replaced with the current epoch
+	// and frees the nodes that no reader can reach any more.
+	void publish(node_pointer t)
+	{
+		root.store(t, std::memory_order_release);
+		uint64_t epoch = global_epoch.load(std::memory_order_relaxed);
+		// a node leaves pending only once it is retired, so none is tagged twice
+		while (!pending.empty())
+		{
+			retired.emplace_back(epoch, pending.back());
+			pending.pop_back();
+		}
+		global_epoch.store(epoch + 1, std::memory_order_release);
+		reclaim();
+	}
+
+	void reclaim(void)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint64_t oldest = global_epoch.load(std::memory_order_relaxed);
+		for (size_type i = 0; i < slot_count; ++i)
+		{
+			uint64_t epoch = slots[i].epoch.load(std::memory_order_acquire);
+			if (epoch != idle_epoch && epoch < oldest)
+				oldest = epoch;
+		}
+		// a node retired in epoch e is unreachable for readers that
+		// announced an epoch after e
+		while (!retired.empty() && retired.front().first < oldest)
+		{
+			destroy_node(retired.front().second);
+			retired.pop_front();
+		}
+	}
+
+private:
+	compare_type                                  comp;
+	allocator_type                                allocator;
+	node_allocator_type                           node_alloc;
+	std::atomic<node_pointer>                     root;
+	std::atomic<uint64_t>                         global_epoch;
+	uint64_t                                      stamp;
+	size_type                                     count;
+	size_type                                     slot_count;
+	std::unique_ptr<reader_slot[]>                slots;
+	std::vector<node_pointer>                     pending;
+	std::vector<node_pointer>                     staged;
+	std::vector<node_pointer>                     created;
+	std::vector<node_pointer>                     discarded;
+	std::deque<std::pair<uint64_t, node_pointer>> retired;
+};
+
+#endif
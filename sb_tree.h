@@ -30,12 +30,21 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __RULER_SB_TREE_H__
 #define __RULER_SB_TREE_H__
 
+#include <algorithm>
+#include <istream>
 #include <memory>
+#include <ostream>
 #include <stdexcept>
+#include <type_traits>
 #include <iterator>
 #include <functional>
 #include <utility>
+#include <vector>
 #include "define.h"
+#include "sb_tree_balance.h"
+#include "sb_tree_image.h"
+#include "sb_tree_parallel.h"
+#include "sb_tree_stats.h"
 
 #ifndef DEFAULT_ALLOCATOR
 #define DEFAULT_ALLOCATOR(T) std::allocator<T>
@@ -50,10 +59,27 @@ static constexpr sb_tree_node_state sb_tree_state_sibling =  0x04;
 
 
 // Class template sb_tree_node
-template <class T>
+template <class T, class Cache = void>
 struct sb_tree_node
 {
-	using node_type            = sb_tree_node<T>;
+	using node_type            = sb_tree_node<T, Cache>;
+	using node_pointer         = node_type*;
+	using const_node_pointer   = const node_type*;
+	using node_reference       = node_type&;
+	using const_node_reference = const node_type&;
+
+	node_pointer               parent;
+	node_pointer               left;
+	node_pointer               right;
+	size_t                     size;
+	Cache                      cache;
+	T                          data;
+};
+
+template <class T>
+struct sb_tree_node<T, void>
+{
+	using node_type            = sb_tree_node<T, void>;
 	using node_pointer         = node_type*;
 	using const_node_pointer   = const node_type*;
 	using node_reference       = node_type&;
@@ -67,6 +93,94 @@ struct sb_tree_node
 };
 
 
+// Class template sb_tree_plain_node_policy
+// Compares keys directly with the comparison function object.
+template <class T>
+struct sb_tree_plain_node_policy
+{
+	using node_type  = sb_tree_node<T>;
+	using probe_type = const T&;
+
+	static inline probe_type make_probe(const T& key) noexcept
+	{
+		return key;
+	}
+
+	static inline void update(node_type*) noexcept
+	{}
+
+	template <class Compare>
+	static inline bool node_less(const Compare& comp, const node_type* n, const T& key)
+	{
+		return comp(n->data, key);
+	}
+
+	template <class Compare>
+	static inline bool key_less(const Compare& comp, const T& key, const node_type* n)
+	{
+		return comp(key, n->data);
+	}
+};
+
+
+// Class template sb_tree_prefix_node_policy
+// Caches the first 8 bytes of a string key inline in the node, packed in
+// big-endian order, so that most comparisons during descent are resolved
+// without touching the heap buffer of the string. The full keys are only
+// compared when the prefixes are equal. The comparison function object must
+// order strings lexicographically by unsigned characters, as std::less does.
+template <class String>
+struct sb_tree_prefix_node_policy
+{
+	static_assert(sizeof(typename String::value_type) == 1,
+		"sb_tree_prefix_node_policy requires a narrow character string.");
+
+	using node_type = sb_tree_node<String, uint64_t>;
+
+	struct probe_type
+	{
+		uint64_t      prefix;
+		const String& key;
+	};
+
+	static inline probe_type make_probe(const String& key) noexcept
+	{
+		return probe_type{ make_prefix(key), key };
+	}
+
+	static inline void update(node_type* n) noexcept
+	{
+		n->cache = make_prefix(n->data);
+	}
+
+	template <class Compare>
+	static inline bool node_less(const Compare& comp, const node_type* n, const probe_type& key)
+	{
+		if (n->cache != key.prefix)
+			return n->cache < key.prefix;
+		return comp(n->data, key.key);
+	}
+
+	template <class Compare>
+	static inline bool key_less(const Compare& comp, const probe_type& key, const node_type* n)
+	{
+		if (key.prefix != n->cache)
+			return key.prefix < n->cache;
+		return comp(key.key, n->data);
+	}
+
+	static inline uint64_t make_prefix(const String& s) noexcept
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+		size_t n = s.size() < 8 ? s.size() : 8;
+		uint64_t prefix = 0;
+		for (size_t i = 0; i < 8; ++i)
+			prefix = (prefix << 8) | (i < n ? p[i] : 0);
+		return prefix;
+	}
+};
+
+
 // Class template sb_tree_type_traits
 
 template <class Tree, bool IsConst>
@@ -197,7 +311,9 @@ public:
 
 	sb_tree_iterator<Tree, IsConst>& operator--(void) noexcept
 	{
-		if (!node->parent || node->parent->parent == node)
+		// the header is the only node of size 0; the root also satisfies
+		// node->parent->parent == node, so that test cannot identify it
+		if (!node->size)
 			node = node->right;
 		else if (node->left)
 		{
@@ -434,14 +550,14 @@ private:
 
 
 // Class template sb_tree_node_allocator
-template <class T, class Allocator>
+template <class T, class Allocator, class Node = sb_tree_node<T>>
 class sb_tree_node_allocator
 {
 public:
 	// types:
 
 	using tree_traits_type     = std::allocator_traits<Allocator>;
-	using tree_node_type       = typename sb_tree_node<T>::node_type;
+	using tree_node_type       = typename Node::node_type;
 	using allocator_type       = typename tree_traits_type::template rebind_alloc<T>;
 	using traits_type          = typename tree_traits_type::template rebind_traits<T>;
 	using node_allocator_type  = typename tree_traits_type::template rebind_alloc<tree_node_type>;
@@ -458,9 +574,11 @@ public:
 	{}
 	explicit sb_tree_node_allocator(const Allocator& alloc)
 		: allocator(alloc)
+		, node_alloc(alloc)
 	{}
 	explicit sb_tree_node_allocator(Allocator&& alloc)
-		: allocator(std::forward<Allocator>(alloc))
+		: allocator(alloc)
+		, node_alloc(std::forward<Allocator>(alloc))
 	{}
 
 	~sb_tree_node_allocator(void)
@@ -498,6 +616,13 @@ protected:
 		node_traits_type::deallocate(node_alloc, p, 1);
 	}
 
+	// The allocators follow the nodes when two trees exchange them.
+	inline void swap_allocator(sb_tree_node_allocator& rhs) noexcept
+	{
+		std::swap(allocator, rhs.allocator);
+		std::swap(node_alloc, rhs.node_alloc);
+	}
+
 private:
 	allocator_type      allocator;
 	node_allocator_type node_alloc;
@@ -505,18 +630,25 @@ private:
 
 
 // Class template sb_tree
-template <class T, class Compare = std::less<T>, class Allocator = DEFAULT_ALLOCATOR(T)>
-class sb_tree : public sb_tree_node_allocator<T, Allocator>
+template <class T, class Compare = std::less<T>, class Allocator = DEFAULT_ALLOCATOR(T),
+	class NodePolicy = sb_tree_plain_node_policy<T>, class BalancePolicy = sb_tree_size_balance,
+	class StatsPolicy = sb_tree_no_stats>
+class sb_tree : public sb_tree_node_allocator<T, Allocator, typename NodePolicy::node_type>, private StatsPolicy
 {
 public:
 	// types:
 
 	using compare_type                     = Compare;
-	using tree_type                        = sb_tree<T, Compare, Allocator>;
+	using node_policy_type                 = NodePolicy;
+	using balance_policy_type              = BalancePolicy;
+	using stats_policy_type                = StatsPolicy;
+	using tree_type                        = sb_tree<T, Compare, Allocator, NodePolicy, BalancePolicy, StatsPolicy>;
+	using base_type                        = sb_tree_node_allocator<T, Allocator, typename NodePolicy::node_type>;
 	using tree_traits_type                 = std::allocator_traits<Allocator>;
-	using node_type                        = typename sb_tree_node<T>::node_type;
-	using node_pointer                     = typename node_type*;
-	using const_node_pointer               = typename const node_type*;
+	using node_type                        = typename NodePolicy::node_type;
+	using node_pointer                     = node_type*;
+	using const_node_pointer               = const node_type*;
+	using probe_type                       = typename NodePolicy::probe_type;
 	using node_allocator_type              = typename tree_traits_type::template rebind_alloc<node_type>;
 	using allocator_type                   = typename tree_traits_type::template rebind_alloc<T>;
 	using traits_type                      = typename tree_traits_type::template rebind_traits<T>;
@@ -540,21 +672,22 @@ public:
 	// construct/copy/destroy:
 
 	explicit sb_tree(const compare_type& compare = compare_type(), const Allocator& alloc = Allocator())
-		: sb_tree_node_allocator<T, Allocator>(alloc)
+		: base_type(alloc)
 		, comp(compare)
 		, header(nullptr)
 	{
 		create_header();
 	}
 	explicit sb_tree(const Allocator& alloc)
-		: sb_tree_node_allocator<T, Allocator>(alloc)
+		: base_type(alloc)
 		, comp(compare_type())
 		, header(nullptr)
 	{
 		create_header();
 	}
 	sb_tree(const tree_type& other)
-		: sb_tree_node_allocator<T, Allocator>()
+		: base_type()
+		, StatsPolicy()
 		, comp(other.comp)
 		, header(nullptr)
 	{
@@ -563,7 +696,8 @@ public:
 			copy_node(other.header->parent);
 	}
 	sb_tree(const tree_type& other, const Allocator& alloc)
-		: sb_tree_node_allocator<T, Allocator>(alloc)
+		: base_type(alloc)
+		, StatsPolicy()
 		, comp(other.comp)
 		, header(nullptr)
 	{
@@ -571,8 +705,23 @@ public:
 		if (other.header->parent)
 			copy_node(other.header->parent);
 	}
+	// Copies the independent subtrees of other in parallel.
+	sb_tree(const tree_type& other, const sb_tree_parallel_policy& policy)
+		: base_type()
+		, StatsPolicy()
+		, comp(other.comp)
+		, header(nullptr)
+	{
+		create_header();
+		if (other.header->parent)
+		{
+			header->parent = copy_subtree(other.header->parent, header, policy);
+			header->left = leftmost(header->parent);
+			header->right = rightmost(header->parent);
+		}
+	}
 	sb_tree(tree_type&& other) noexcept
-		: sb_tree_node_allocator<T, Allocator>()
+		: base_type()
 		, comp(Compare())
 		, header(nullptr)
 	{
@@ -580,7 +729,7 @@ public:
 		swap(other);
 	}
 	sb_tree(tree_type&& other, const Allocator& alloc) noexcept
-		: sb_tree_node_allocator<T, Allocator>(alloc)
+		: base_type(alloc)
 		, comp(Compare())
 		, header(nullptr)
 	{
@@ -588,7 +737,7 @@ public:
 		swap(other);
 	}
 	sb_tree(std::initializer_list<T> ilist, const Allocator& alloc = Allocator())
-		: sb_tree_node_allocator<T, Allocator>(alloc)
+		: base_type(alloc)
 		, comp(Compare())
 		, header(nullptr)
 	{
@@ -608,7 +757,7 @@ public:
 		{
 			clear();
 			if (other.header->parent)
-				copy_root(other.header->parent);
+				copy_node(other.header->parent);
 			comp = other.comp;
 		}
 		return *this;
@@ -652,6 +801,25 @@ public:
 		insert_unique(ilist.begin(), ilist.end());
 	}
 
+	// Replaces the contents with the elements of [first, last), which must
+	// be sorted, as a perfectly balanced tree in linear time.
+	template <class RandomIt>
+	inline void assign_sorted(RandomIt first, RandomIt last)
+	{
+		assign_sorted(first, last, sb_tree_parallel_policy(1));
+	}
+	template <class RandomIt>
+	void assign_sorted(RandomIt first, RandomIt last, const sb_tree_parallel_policy& policy)
+	{
+		clear();
+		if (first != last)
+		{
+			header->parent = build_subtree(first, static_cast<size_type>(last - first), header, policy);
+			header->left = leftmost(header->parent);
+			header->right = rightmost(header->parent);
+		}
+	}
+
 	// iterators:
 
 	inline iterator begin(void) noexcept
@@ -773,6 +941,112 @@ public:
 		return comp;
 	}
 
+	// A snapshot of the counters of the stats policy; all zero with
+	// sb_tree_no_stats.
+	inline sb_tree_statistics stats(void) const noexcept
+	{
+		return counters().snapshot();
+	}
+
+	inline void reset_stats(void) noexcept
+	{
+		StatsPolicy::reset();
+	}
+
+	inline const stats_policy_type& stats_policy(void) const noexcept
+	{
+		return *this;
+	}
+
+	// Walks the tree once in order. The allocator bytes are estimated for a
+	// malloc that adds one word to each chunk and aligns it to two words, as
+	// glibc does; memory owned by the elements themselves is not included.
+	sb_tree_diagnostics diagnostics(void) const
+	{
+		sb_tree_diagnostics d = diagnostics_totals();
+		diagnostics(d, 0, size());
+		sb_tree_finish_diagnostics(d);
+		return d;
+	}
+
+	// The size and memory of the tree, with no level walked yet. A tree can
+	// then be walked in slices of ranks, with the tree changing in between,
+	// and sb_tree_finish_diagnostics derives the depths from the levels.
+	sb_tree_diagnostics diagnostics_totals(void) const
+	{
+		sb_tree_diagnostics d;
+		d.size = size();
+		d.height = 0;
+		d.optimal_height = 0;
+		for (size_type n = d.size; n; n >>= 1)
+			++d.optimal_height;
+		d.max_depth = 0;
+		d.average_depth = 0.0;
+		size_t chunk = sizeof(node_type) + sizeof(void*);
+		chunk = (chunk + 2 * sizeof(void*) - 1) / (2 * sizeof(void*)) * (2 * sizeof(void*));
+		if (chunk < 4 * sizeof(void*))
+			chunk = 4 * sizeof(void*);
+		d.node_bytes = d.size * sizeof(node_type);
+		d.header_bytes = sizeof(node_type) + sizeof(tree_type);
+		d.allocator_bytes = (d.size + 1) * chunk;
+		return d;
+	}
+
+	// Adds the levels and the balance slack of the nodes of ranks [first,
+	// first + count) to d, and returns the number of nodes walked, which is
+	// less than count at the end of the tree.
+	size_type diagnostics(sb_tree_diagnostics& d, size_type first, size_type count) const
+	{
+		// the descent to the first rank gives its depth
+		node_pointer t = header->parent;
+		size_t depth = 0;
+		while (t)
+		{
+			size_type left_size = t->left ? t->left->size : 0;
+			if (first == left_size)
+				break;
+			if (first < left_size)
+				t = t->left;
+			else
+			{
+				first -= left_size + 1;
+				t = t->right;
+			}
+			++depth;
+		}
+		size_type walked = 0;
+		while (t && walked < count)
+		{
+			if (depth >= d.depth_histogram.size())
+			{
+				d.depth_histogram.resize(depth + 1, 0);
+				d.balance_slack.resize(depth + 1, PTRDIFF_MAX);
+			}
+			++d.depth_histogram[depth];
+			ptrdiff_t slack = balance_slack(t);
+			if (slack < d.balance_slack[depth])
+				d.balance_slack[depth] = slack;
+			++walked;
+			// the successor, and its depth
+			if (t->right)
+			{
+				t = t->right;
+				++depth;
+				for (; t->left; t = t->left)
+					++depth;
+			}
+			else
+			{
+				node_pointer p = t->parent;
+				for (; p != header && t == p->right; t = p, p = p->parent)
+					--depth;
+				t = p != header ? p : nullptr;
+				--depth;
+			}
+		}
+		return walked;
+	}
+
 	// element access:
 
 	inline reference operator[](size_type pos) noexcept
@@ -806,16 +1080,19 @@ public:
 	template <class... Args>
 	inline iterator emplace_equal(Args&&... args)
 	{
+		auto timer = counters().start(sb_tree_op::insert_equal);
 		return iterator(insert_equal_node(std::forward<Args>(args)...));
 	}
 
 	inline iterator insert_equal(const value_type& value)
 	{
+		auto timer = counters().start(sb_tree_op::insert_equal);
 		return iterator(insert_equal_node(value));
 	}
 
 	inline iterator insert_equal(value_type&& value)
 	{
+		auto timer = counters().start(sb_tree_op::insert_equal);
 		return iterator(insert_equal_node(std::forward<value_type>(value)));
 	}
 	inline iterator insert_equal(size_type n, const value_type& value)
@@ -849,17 +1126,20 @@ public:
 	template <class... Args>
 	inline std::pair<iterator, bool> emplace_unique(Args&&... args)
 	{
+		auto timer = counters().start(sb_tree_op::insert_unique);
 		auto res = insert_unique_node(std::forward<Args>(args)...);
 		return std::make_pair(iterator(res.first), res.second);
 	}
 
 	inline std::pair<iterator, bool> insert_unique(const value_type& value)
 	{
+		auto timer = counters().start(sb_tree_op::insert_unique);
 		auto res = insert_unique_node(value);
 		return std::make_pair(iterator(res.first), res.second);
 	}
 	inline std::pair<iterator, bool> insert_unique(value_type&& value)
 	{
+		auto timer = counters().start(sb_tree_op::insert_unique);
 		auto res = insert_unique_node(std::forward<value_type>(value));
 		return std::make_pair(iterator(res.first), res.second);
 	}
@@ -874,8 +1154,31 @@ public:
 		insert_unique(ilist.begin(), ilist.end());
 	}
 
+	inline iterator insert_equal(const_iterator hint, const value_type& value)
+	{
+		auto timer = counters().start(sb_tree_op::insert_equal);
+		return iterator(insert_equal_hint_node(hint.get_pointer(), value));
+	}
+	inline iterator insert_equal(const_iterator hint, value_type&& value)
+	{
+		auto timer = counters().start(sb_tree_op::insert_equal);
+		return iterator(insert_equal_hint_node(hint.get_pointer(), std::forward<value_type>(value)));
+	}
+
+	inline iterator insert_unique(const_iterator hint, const value_type& value)
+	{
+		auto timer = counters().start(sb_tree_op::insert_unique);
+		return iterator(insert_unique_hint_node(hint.get_pointer(), value).first);
+	}
+	inline iterator insert_unique(const_iterator hint, value_type&& value)
+	{
+		auto timer = counters().start(sb_tree_op::insert_unique);
+		return iterator(insert_unique_hint_node(hint.get_pointer(), std::forward<value_type>(value)).first);
+	}
+
 	inline iterator erase(const_iterator pos)
 	{
+		auto timer = counters().start(sb_tree_op::erase);
 		iterator next = iterator(pos.get_pointer());
 		if (pos != cend())
 		{
@@ -896,13 +1199,14 @@ public:
 	}
 	inline size_type erase(const value_type& key)
 	{
+		auto timer = counters().start(sb_tree_op::erase);
 		size_type count = 0;
-		iterator first = lower_bound(key);
-		iterator last = upper_bound(key);
+		iterator first = iterator(lower_bound_node(key));
+		iterator last = iterator(upper_bound_node(key));
 		while (first != last)
 		{
 			++count;
-			erase(first++);
+			erase_node((first++).get_pointer());
 		}
 		return count;
 	}
@@ -913,7 +1217,128 @@ public:
 		{
 			std::swap(header, rhs.header);
 			std::swap(comp, rhs.comp);
+			this->swap_allocator(rhs);
+		}
+	}
+
+	// serialization:
+
+	// Writes a header and the elements in order. Trivially copyable
+	// elements are written as raw bytes, in large blocks.
+	void save(std::ostream& os) const
+	{
+		static_assert(std::is_trivially_copyable<value_type>::value,
+			"save without a writer requires a trivially copyable value_type.");
+		sb_tree_image_header h;
+		h.init(sb_tree_image_raw, sizeof(value_type), size());
+		write_bytes(os, &h, sizeof(h));
+		std::vector<value_type> block;
+		block.reserve(size() < io_block ? size() : io_block);
+		for (const_iterator it = cbegin(); it != cend(); ++it)
+		{
+			block.push_back(*it);
+			if (block.size() == io_block)
+			{
+				write_bytes(os, block.data(), block.size() * sizeof(value_type));
+				block.clear();
+			}
+		}
+		write_bytes(os, block.data(), block.size() * sizeof(value_type));
+	}
+
+	// Writes a header, then calls writer(os, x) for each element x in order.
+	template <class Writer>
+	void save(std::ostream& os, Writer writer) const
+	{
+		sb_tree_image_header h;
+		h.init(0, 0, size());
+		write_bytes(os, &h, sizeof(h));
+		for (const_iterator it = cbegin(); it != cend(); ++it)
+			writer(os, *it);
+		if (!os)
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+	// Replaces the contents with a tree written by save(os), rebuilt in
+	// linear time.
+	void load(std::istream& is, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy(1))
+	{
+		static_assert(std::is_trivially_copyable<value_type>::value,
+			"load without a reader requires a trivially copyable value_type.");
+		sb_tree_image_header h;
+		read_header(is, h);
+		if (!(h.flags & sb_tree_image_raw) || h.element_size != sizeof(value_type))
+			throw std::runtime_error(SBT_BAD_IMAGE);
+		// the count is not trusted: the elements are read in bounded chunks,
+		// so a corrupt count fails on the missing bytes
+		const size_type chunk = load_chunk_bytes / sizeof(value_type) + 1;
+		std::vector<value_type> elements;
+		for (uint64_t n = h.count; n;)
+		{
+			size_type k = n < chunk ? static_cast<size_type>(n) : chunk;
+			size_type first = elements.size();
+			elements.resize(first + k);
+			read_bytes(is, elements.data() + first, k * sizeof(value_type));
+			n -= k;
+		}
+		load_sorted(elements, policy);
+	}
+
+	// Replaces the contents with a tree written by save(os, writer); reader(is)
+	// returns the next element.
+	template <class Reader>
+	void load(std::istream& is, Reader reader, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy(1))
+	{
+		sb_tree_image_header h;
+		read_header(is, h);
+		if (h.flags & sb_tree_image_raw)
+			throw std::runtime_error(SBT_BAD_IMAGE);
+		std::vector<value_type> elements;
+		// the count is not trusted, so it only bounds the first allocation
+		elements.reserve(static_cast<size_type>(std::min<uint64_t>(h.count, load_chunk_bytes / sizeof(value_type) + 1)));
+		for (uint64_t i = 0; i < h.count; ++i)
+		{
+			elements.push_back(reader(is));
+			if (!is)
+				throw std::runtime_error(SBT_BAD_IMAGE);
 		}
+		load_sorted(elements, policy);
+	}
+
+	// set operations:
+	//
+	// The joins reuse the nodes of other; when the allocators of the two
+	// trees differ, the elements are moved into new nodes instead.
+
+	// Adds the elements of other whose keys are not in this tree, and leaves
+	// other empty. Both trees must order their elements the same way.
+	inline void merge_union(tree_type& other)
+	{
+		merge_union(other, sb_tree_parallel_policy(1));
+	}
+	void merge_union(tree_type& other, const sb_tree_parallel_policy& policy)
+	{
+		set_operation(other, policy, set_union);
+	}
+
+	// Keeps the elements whose keys are in other, and leaves other empty.
+	inline void intersect(tree_type& other)
+	{
+		intersect(other, sb_tree_parallel_policy(1));
+	}
+	void intersect(tree_type& other, const sb_tree_parallel_policy& policy)
+	{
+		set_operation(other, policy, set_intersection);
+	}
+
+	// Removes the elements whose keys are in other, and leaves other empty.
+	inline void difference(tree_type& other)
+	{
+		difference(other, sb_tree_parallel_policy(1));
+	}
+	void difference(tree_type& other, const sb_tree_parallel_policy& policy)
+	{
+		set_operation(other, policy, set_difference);
 	}
 
 	inline void clear(void)
@@ -931,45 +1356,139 @@ public:
 
 	inline iterator find(const value_type& key) noexcept
 	{
-		return iterator(find_node(key));
+		auto timer = counters().start(sb_tree_op::find);
+		node_pointer last = nullptr;
+		node_pointer n = find_node(key, &last);
+		return iterator(access_node(n, last));
 	}
 	inline const_iterator find(const value_type& key) const noexcept
 	{
+		auto timer = counters().start(sb_tree_op::find);
 		return const_iterator(find_node(key));
 	}
 
+	inline iterator find(const_iterator hint, const value_type& key) noexcept
+	{
+		auto timer = counters().start(sb_tree_op::find);
+		node_pointer last = nullptr;
+		node_pointer n = find_node(hint.get_pointer(), key, &last);
+		return iterator(access_node(n, last));
+	}
+	inline const_iterator find(const_iterator hint, const value_type& key) const noexcept
+	{
+		auto timer = counters().start(sb_tree_op::find);
+		return const_iterator(find_node(hint.get_pointer(), key));
+	}
+
 	inline iterator lower_bound(const value_type& key) noexcept
 	{
-		return iterator(lower_bound_node(key));
+		auto timer = counters().start(sb_tree_op::lower_bound);
+		node_pointer last = nullptr;
+		node_pointer n = lower_bound_node(key, &last);
+		return iterator(access_node(n, last));
 	}
 	inline const_iterator lower_bound(const value_type& key) const noexcept
 	{
+		auto timer = counters().start(sb_tree_op::lower_bound);
 		return const_iterator(lower_bound_node(key));
 	}
 
+	inline iterator lower_bound(const_iterator hint, const value_type& key) noexcept
+	{
+		auto timer = counters().start(sb_tree_op::lower_bound);
+		node_pointer last = nullptr;
+		node_pointer n = lower_bound_node(hint.get_pointer(), key, &last);
+		return iterator(access_node(n, last));
+	}
+	inline const_iterator lower_bound(const_iterator hint, const value_type& key) const noexcept
+	{
+		auto timer = counters().start(sb_tree_op::lower_bound);
+		return const_iterator(lower_bound_node(hint.get_pointer(), key));
+	}
+
 	inline iterator upper_bound(const value_type& key) noexcept
 	{
-		return iterator(upper_bound_node(key));
+		auto timer = counters().start(sb_tree_op::upper_bound);
+		node_pointer last = nullptr;
+		node_pointer n = upper_bound_node(key, &last);
+		return iterator(access_node(n, last));
 	}
 	inline const_iterator upper_bound(const value_type& key) const noexcept
 	{
+		auto timer = counters().start(sb_tree_op::upper_bound);
 		return const_iterator(upper_bound_node(key));
 	}
 
+	inline iterator upper_bound(const_iterator hint, const value_type& key) noexcept
+	{
+		auto timer = counters().start(sb_tree_op::upper_bound);
+		node_pointer last = nullptr;
+		node_pointer n = upper_bound_node(hint.get_pointer(), key, &last);
+		return iterator(access_node(n, last));
+	}
+	inline const_iterator upper_bound(const_iterator hint, const value_type& key) const noexcept
+	{
+		auto timer = counters().start(sb_tree_op::upper_bound);
+		return const_iterator(upper_bound_node(hint.get_pointer(), key));
+	}
+
 	inline iterator select(size_type idx) noexcept
 	{
+		auto timer = counters().start(sb_tree_op::select);
 		return iterator(select_node(idx));
 	}
 	inline const_iterator select(size_type idx) const noexcept
 	{
+		auto timer = counters().start(sb_tree_op::select);
 		return const_iterator(select_node(idx));
 	}
 
 	inline size_type rank(const value_type& key) const noexcept
 	{
+		auto timer = counters().start(sb_tree_op::rank);
 		return rank_node(key);
 	}
 
+	// parallel traversal:
+
+	// Calls f on every element of [first, last). The range is cut by rank
+	// into chunks of equal size, one per worker, and each chunk is traversed
+	// sequentially, so f may be called concurrently on different elements.
+	template <class Function>
+	inline void parallel_for_each(iterator first, iterator last, Function f, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy())
+	{
+		size_type lo = index_node(first.get_pointer());
+		size_type hi = index_node(last.get_pointer());
+		if (lo < hi)
+			for_each_range(lo, hi, f, policy);
+	}
+	template <class Function>
+	inline void parallel_for_each(const_iterator first, const_iterator last, Function f, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy()) const
+	{
+		size_type lo = index_node(first.get_pointer());
+		size_type hi = index_node(last.get_pointer());
+		if (lo < hi)
+			for_each_range(lo, hi, f, policy);
+	}
+
+	// Combines init with transform(x) for every element x of [first, last)
+	// through reduce, which must be associative. The chunks are reduced as
+	// in parallel_for_each, and the partial results are combined in order.
+	template <class R, class Reduce, class Transform>
+	R parallel_reduce(const_iterator first, const_iterator last, R init, Reduce reduce, Transform transform, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy()) const
+	{
+		size_type lo = index_node(first.get_pointer());
+		size_type hi = index_node(last.get_pointer());
+		if (lo < hi)
+			return reduce(std::move(init), reduce_range<R>(lo, hi, reduce, transform, policy));
+		return init;
+	}
+	template <class R, class Reduce>
+	inline R parallel_reduce(const_iterator first, const_iterator last, R init, Reduce reduce, const sb_tree_parallel_policy& policy = sb_tree_parallel_policy()) const
+	{
+		return parallel_reduce(first, last, std::move(init), reduce, [](const value_type& x) -> const value_type& { return x; }, policy);
+	}
+
 private:
 
 	inline node_pointer root(void) const noexcept
@@ -977,6 +1496,21 @@ private:
 		return header->parent ? header->parent : header;
 	}
 
+	static inline ptrdiff_t subtree_size(const_node_pointer t) noexcept
+	{
+		return t ? static_cast<ptrdiff_t>(t->size) : 0;
+	}
+
+	// The smallest margin of the Size-Balanced Tree properties at t.
+	static ptrdiff_t balance_slack(const_node_pointer t) noexcept
+	{
+		ptrdiff_t left = subtree_size(t->left);
+		ptrdiff_t right = subtree_size(t->right);
+		ptrdiff_t left_nephews = t->right ? std::max(subtree_size(t->right->left), subtree_size(t->right->right)) : 0;
+		ptrdiff_t right_nephews = t->left ? std::max(subtree_size(t->left->left), subtree_size(t->left->right)) : 0;
+		return std::min(left - left_nephews, right - right_nephews);
+	}
+
 	inline node_pointer leftmost(node_pointer t) const noexcept
 	{
 		while (t->left)
@@ -1000,6 +1534,7 @@ private:
 			header->left = header;
 			header->right = header;
 			header->size = 0;
+			NodePolicy::update(header);
 		}
 	}
 
@@ -1012,13 +1547,62 @@ private:
 		}
 	}
 
-	node_pointer find_node(const value_type& key) const noexcept
+	inline const StatsPolicy& counters(void) const noexcept
+	{
+		return *this;
+	}
+
+	// Shadow the allocator base so that the stats policy sees every node.
+	template <class ...Args>
+	inline node_pointer create_node(Args&&... args)
+	{
+		node_pointer p = base_type::create_node(std::forward<Args>(args)...);
+		counters().count_allocation();
+		return p;
+	}
+
+	inline void destroy_node(const node_pointer p)
+	{
+		counters().count_deallocation();
+		base_type::destroy_node(p);
+	}
+
+	// Lets a self-adjusting balance policy restructure the tree after a
+	// non-const lookup. The last node of the descent is accessed first, so
+	// that the whole search path is paid for even on a miss, then the node
+	// found, if it is another one.
+	inline node_pointer access_node(node_pointer n, node_pointer last)
+	{
+		if (last)
+			BalancePolicy::access(header, last, counters());
+		if (n != header && n != last)
+			BalancePolicy::access(header, n, counters());
+		return n;
+	}
+
+	inline bool node_less(const_node_pointer n, const probe_type& key) const
+	{
+		counters().count_comparison();
+		return NodePolicy::node_less(comp, n, key);
+	}
+
+	inline bool key_less(const probe_type& key, const_node_pointer n) const
+	{
+		counters().count_comparison();
+		return NodePolicy::key_less(comp, key, n);
+	}
+
+	node_pointer find_node(const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
+		probe_type probe = NodePolicy::make_probe(key);
 		node_pointer pre = header;
 		node_pointer cur = header->parent;
+		node_pointer prev = nullptr;
 		while (cur)
 		{
-			if (!comp(cur->data, key))
+			prev = cur;
+			counters().count_visit();
+			if (!node_less(cur, probe))
 			{
 				pre = cur;
 				cur = cur->left;
@@ -1026,18 +1610,24 @@ private:
 			else
 				cur = cur->right;
 		}
-		if (comp(key, pre->data))
+		if (last)
+			*last = prev;
+		if (key_less(probe, pre))
 			pre = header;
 		return pre;
 	}
 
-	node_pointer lower_bound_node(const value_type& key) const noexcept
+	node_pointer lower_bound_node(const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
+		probe_type probe = NodePolicy::make_probe(key);
 		node_pointer pre = header;
 		node_pointer cur = header->parent;
+		node_pointer prev = nullptr;
 		while (cur)
 		{
-			if (!comp(cur->data, key))
+			prev = cur;
+			counters().count_visit();
+			if (!node_less(cur, probe))
 			{
 				pre = cur;
 				cur = cur->left;
@@ -1045,16 +1635,22 @@ private:
 			else
 				cur = cur->right;
 		}
+		if (last)
+			*last = prev;
 		return pre;
 	}
 
-	node_pointer upper_bound_node(const value_type& key) const noexcept
+	node_pointer upper_bound_node(const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
+		probe_type probe = NodePolicy::make_probe(key);
 		node_pointer pre = header;
 		node_pointer cur = header->parent;
+		node_pointer prev = nullptr;
 		while (cur)
 		{
-			if (comp(key, cur->data))
+			prev = cur;
+			counters().count_visit();
+			if (key_less(probe, cur))
 			{
 				pre = cur;
 				cur = cur->left;
@@ -1062,175 +1658,722 @@ private:
 			else
 				cur = cur->right;
 		}
+		if (last)
+			*last = prev;
 		return pre;
 	}
 
-	node_pointer select_node(size_type k) const noexcept
+	// The finger searches start from the hint node h instead of the root. They
+	// climb from h until the key is bracketed by the subtree of the current
+	// node and the ancestor bounding it, then descend into that subtree. The
+	// climb costs O(log d) when the subtree spanning h and the result has
+	// height O(log d), where d is their rank distance, and O(1) amortized over
+	// a monotone sequence of probes, like iterator increments.
+
+	node_pointer find_node(node_pointer h, const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
-		node_pointer t = header->parent;
-		while (t)
-		{
-			size_type left_size = t->left ? t->left->size : 0;
-			if (left_size < k)
-			{
-				t = t->right;
-				k -= (left_size + 1);
-			}
-			else if (k < left_size)
-				t = t->left;
-			else
-				return t;
-		}
-		return header;
+		node_pointer pre = lower_bound_node(h, key, last);
+		if (pre != header && key_less(NodePolicy::make_probe(key), pre))
+			pre = header;
+		return pre;
 	}
 
-	size_type rank_node(const value_type& key) const noexcept
+	node_pointer lower_bound_node(node_pointer h, const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
-		size_type rank = 0;
+		probe_type probe = NodePolicy::make_probe(key);
 		node_pointer pre = header;
-		node_pointer cur = header->parent;
+		node_pointer cur = h == header ? header->right : h;
+		if (!header->parent)
+			return header;
+		if (node_less(cur, probe))
+		{
+			// the lower bound follows h
+			if (h == header)
+				return header;
+			while (cur != header->parent)
+			{
+				node_pointer p = cur->parent;
+				if (cur == p->left && !node_less(p, probe))
+				{
+					pre = p;
+					break;
+				}
+				cur = p;
+			}
+		}
+		else
+		{
+			// the lower bound is h or precedes it
+			while (cur != header->parent)
+			{
+				node_pointer p = cur->parent;
+				if (cur == p->right && node_less(p, probe))
+					break;
+				cur = p;
+			}
+		}
+		node_pointer prev = nullptr;
 		while (cur)
 		{
-			if (!comp(cur->data, key))
+			prev = cur;
+			counters().count_visit();
+			if (!node_less(cur, probe))
 			{
 				pre = cur;
 				cur = cur->left;
 			}
 			else
-			{
-				rank += cur->left ? cur->left->size + 1 : 1;
 				cur = cur->right;
-			}
 		}
-		if (pre == header || comp(key, pre->data))
-			rank = static_cast<size_type>(-1);
-		return rank;
+		if (last)
+			*last = prev;
+		return pre;
 	}
 
-	void copy_node(const node_pointer t)
+	node_pointer upper_bound_node(node_pointer h, const value_type& key, node_pointer* last = nullptr) const noexcept
 	{
-		bool flag = true;
-		node_pointer src = t;
-		node_pointer dst = header;
-		// copies the t node
-		node_pointer n = this->create_node(t->data);
-		n->parent = dst;
-		n->left = nullptr;
-		n->right = nullptr;
-		n->size = t->size;
-		dst->parent = n;
-		// update dst to root node
-		dst = n;
-		do
+		probe_type probe = NodePolicy::make_probe(key);
+		node_pointer pre = header;
+		node_pointer cur = h == header ? header->right : h;
+		if (!header->parent)
+			return header;
+		if (!key_less(probe, cur))
 		{
-			if (flag && src->left)
+			// the upper bound follows h
+			if (h == header)
+				return header;
+			while (cur != header->parent)
 			{
-				src = src->left;
-				// copies the left child node
-				n = this->create_node(src->data);
-				n->parent = dst;
-				n->left = nullptr;
-				n->right = nullptr;
-				n->size = src->size;
-				dst->left = n;
-				// update dst to left child node
-				dst = n;
+				node_pointer p = cur->parent;
+				if (cur == p->left && key_less(probe, p))
+				{
+					pre = p;
+					break;
+				}
+				cur = p;
 			}
-			else if (flag && src->right)
+		}
+		else
+		{
+			// the upper bound is h or precedes it
+			while (cur != header->parent)
 			{
-				src = src->right;
-				// copies the right child node
-				n = this->create_node(src->data);
-				n->parent = dst;
-				n->left = nullptr;
-				n->right = nullptr;
-				n->size = src->size;
-				dst->right = n;
-				// update dst to right child node
-				dst = n;
+				node_pointer p = cur->parent;
+				if (cur == p->right && !key_less(probe, p))
+					break;
+				cur = p;
 			}
-			else if (src->parent->right && src != src->parent->right)
+		}
+		node_pointer prev = nullptr;
+		while (cur)
+		{
+			prev = cur;
+			counters().count_visit();
+			if (key_less(probe, cur))
 			{
-				src = src->parent->right;
-				// copies the sibling node
-				n = this->create_node(src->data);
-				n->parent = dst->parent;
-				n->left = nullptr;
-				n->right = nullptr;
-				n->size = src->size;
-				dst->parent->right = n;
-				// update dst to sibling node
-				dst = n;
-				flag = true;
+				pre = cur;
+				cur = cur->left;
+			}
+			else
+				cur = cur->right;
+		}
+		if (last)
+			*last = prev;
+		return pre;
+	}
+
+	// Returns the position of n in order; the header is at size().
+	size_type index_node(node_pointer n) const noexcept
+	{
+		if (n == header)
+			return size();
+		size_type idx = n->left ? n->left->size : 0;
+		for (node_pointer p = n->parent; p != header; n = p, p = p->parent)
+		{
+			if (n == p->right)
+				idx += (p->left ? p->left->size : 0) + 1;
+		}
+		return idx;
+	}
+
+	template <class Function>
+	void for_each_range(size_type lo, size_type hi, Function& f, const sb_tree_parallel_policy& policy)
+	{
+		if (policy.fork(hi - lo))
+		{
+			size_type mid = lo + (hi - lo) / 2;
+			sb_tree_fork_join(
+				[&] { for_each_range(lo, mid, f, policy.left()); },
+				[&] { for_each_range(mid, hi, f, policy.right()); });
+			return;
+		}
+		iterator it(select_node(lo));
+		for (size_type i = lo; i < hi; ++i, ++it)
+			f(*it);
+	}
+
+	template <class Function>
+	void for_each_range(size_type lo, size_type hi, Function& f, const sb_tree_parallel_policy& policy) const
+	{
+		if (policy.fork(hi - lo))
+		{
+			size_type mid = lo + (hi - lo) / 2;
+			sb_tree_fork_join(
+				[&] { for_each_range(lo, mid, f, policy.left()); },
+				[&] { for_each_range(mid, hi, f, policy.right()); });
+			return;
+		}
+		const_iterator it(select_node(lo));
+		for (size_type i = lo; i < hi; ++i, ++it)
+			f(*it);
+	}
+
+	template <class R, class Reduce, class Transform>
+	R reduce_range(size_type lo, size_type hi, Reduce& reduce, Transform& transform, const sb_tree_parallel_policy& policy) const
+	{
+		if (policy.fork(hi - lo))
+		{
+			size_type mid = lo + (hi - lo) / 2;
+			std::unique_ptr<R> lhs;
+			std::unique_ptr<R> rhs;
+			sb_tree_fork_join(
+				[&] { lhs.reset(new R(reduce_range<R>(lo, mid, reduce, transform, policy.left()))); },
+				[&] { rhs.reset(new R(reduce_range<R>(mid, hi, reduce, transform, policy.right()))); });
+			return reduce(std::move(*lhs), std::move(*rhs));
+		}
+		const_iterator it(select_node(lo));
+		R acc = transform(*it);
+		for (size_type i = lo + 1; i < hi; ++i)
+			acc = reduce(std::move(acc), transform(*++it));
+		return acc;
+	}
+
+	node_pointer select_node(size_type k) const noexcept
+	{
+		node_pointer t = header->parent;
+		while (t)
+		{
+			counters().count_visit();
+			size_type left_size = t->left ? t->left->size : 0;
+			if (left_size < k)
+			{
+				t = t->right;
+				k -= (left_size + 1);
+			}
+			else if (k < left_size)
+				t = t->left;
+			else
+				return t;
+		}
+		return header;
+	}
+
+	size_type rank_node(const value_type& key) const noexcept
+	{
+		probe_type probe = NodePolicy::make_probe(key);
+		size_type rank = 0;
+		node_pointer pre = header;
+		node_pointer cur = header->parent;
+		while (cur)
+		{
+			counters().count_visit();
+			if (!node_less(cur, probe))
+			{
+				pre = cur;
+				cur = cur->left;
 			}
 			else
 			{
-				// return to parent node
-				src = src->parent;
-				dst = dst->parent;
-				flag = false;
+				rank += cur->left ? cur->left->size + 1 : 1;
+				cur = cur->right;
 			}
-		} while (src != t);
+		}
+		if (pre == header || key_less(probe, pre))
+			rank = static_cast<size_type>(-1);
+		return rank;
+	}
+
+	void copy_node(const node_pointer t)
+	{
+		header->parent = copy_subtree(t, header);
 		header->left = leftmost(header->parent);
 		header->right = rightmost(header->parent);
 	}
 
+	// Copies the t subtree under parent and returns the copy.
+	node_pointer copy_subtree(const node_pointer t, const node_pointer parent)
+	{
+		bool flag = true;
+		node_pointer src = t;
+		// copies the t node
+		node_pointer root = clone_node(t, parent);
+		node_pointer dst = root;
+		try
+		{
+			for (;;)
+			{
+				if (flag && src->left)
+				{
+					src = src->left;
+					// copies the left child node
+					dst->left = clone_node(src, dst);
+					// update dst to left child node
+					dst = dst->left;
+				}
+				else if (flag && src->right)
+				{
+					src = src->right;
+					// copies the right child node
+					dst->right = clone_node(src, dst);
+					// update dst to right child node
+					dst = dst->right;
+				}
+				else if (src == t)
+					break;
+				else if (src->parent->right && src != src->parent->right)
+				{
+					src = src->parent->right;
+					// copies the sibling node
+					dst->parent->right = clone_node(src, dst->parent);
+					// update dst to sibling node
+					dst = dst->parent->right;
+					flag = true;
+				}
+				else
+				{
+					// return to parent node
+					src = src->parent;
+					dst = dst->parent;
+					flag = false;
+				}
+			}
+		}
+		catch (...)
+		{
+			destroy_subtree(root);
+			throw;
+		}
+		return root;
+	}
+
+	// Copies the t subtree under parent, forking while the subtrees are
+	// larger than the grain.
+	node_pointer copy_subtree(const node_pointer t, const node_pointer parent, const sb_tree_parallel_policy& policy)
+	{
+		if (!policy.fork(t->size))
+			return copy_subtree(t, parent);
+		node_pointer n = clone_node(t, parent);
+		try
+		{
+			// each side only writes its own child link
+			sb_tree_fork_join(
+				[&] { if (t->left) n->left = copy_subtree(t->left, n, policy.left()); },
+				[&] { if (t->right) n->right = copy_subtree(t->right, n, policy.right()); });
+		}
+		catch (...)
+		{
+			destroy_subtree(n);
+			throw;
+		}
+		return n;
+	}
+
+	// Builds the n sorted elements from first as a perfectly balanced
+	// subtree under parent. Sibling sizes differ by one at most, so the size
+	// and weight balance properties hold; the treap heap order does not.
+	template <class RandomIt>
+	node_pointer build_subtree(RandomIt first, size_type n, const node_pointer parent, const sb_tree_parallel_policy& policy)
+	{
+		size_type mid = n / 2;
+		node_pointer t = this->create_node(first[mid]);
+		NodePolicy::update(t);
+		t->parent = parent;
+		t->left = nullptr;
+		t->right = nullptr;
+		t->size = n;
+		try
+		{
+			if (policy.fork(n))
+			{
+				// each side only writes its own child link
+				sb_tree_fork_join(
+					[&] { if (mid) t->left = build_subtree(first, mid, t, policy.left()); },
+					[&] { if (n - mid - 1) t->right = build_subtree(first + mid + 1, n - mid - 1, t, policy.right()); });
+			}
+			else
+			{
+				if (mid)
+					t->left = build_subtree(first, mid, t, policy);
+				if (n - mid - 1)
+					t->right = build_subtree(first + mid + 1, n - mid - 1, t, policy);
+			}
+		}
+		catch (...)
+		{
+			destroy_subtree(t);
+			throw;
+		}
+		return t;
+	}
+
+	// elements per write of save
+	static constexpr size_type io_block = 65536;
+
+	static inline void write_bytes(std::ostream& os, const void* p, size_type n)
+	{
+		if (n && !os.write(static_cast<const char*>(p), static_cast<std::streamsize>(n)))
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+	// The most that load allocates ahead of the elements it has read.
+	static constexpr size_type load_chunk_bytes = 1 << 20;
+
+	static inline void read_bytes(std::istream& is, void* p, size_type n)
+	{
+		if (n && !is.read(static_cast<char*>(p), static_cast<std::streamsize>(n)))
+			throw std::runtime_error(SBT_BAD_IMAGE);
+	}
+
+	inline void load_sorted(std::vector<value_type>& elements, const sb_tree_parallel_policy& policy)
+	{
+		if (!std::is_sorted(elements.begin(), elements.end(), comp))
+			throw std::runtime_error(SBT_BAD_IMAGE);
+		assign_sorted(elements.begin(), elements.end(), policy);
+	}
+
+	inline void read_header(std::istream& is, sb_tree_image_header& h) const
+	{
+		read_bytes(is, &h, sizeof(h));
+		if (!h.valid() || h.count > this->max_size())
+			throw std::runtime_error(SBT_BAD_IMAGE);
+	}
+
+	enum set_operation_type
+	{
+		set_union,
+		set_intersection,
+		set_difference
+	};
+
+	// The subtrees of a split: the elements less than, equivalent to and
+	// greater than the key.
+	struct split_type
+	{
+		node_pointer less;
+		node_pointer equal;
+		node_pointer greater;
+	};
+
+	void set_operation(tree_type& other, const sb_tree_parallel_policy& policy, set_operation_type op)
+	{
+		if (this == &other)
+		{
+			if (op == set_difference)
+				clear();
+			return;
+		}
+		// the nodes of other are adopted only when this allocator can free them
+		if (this->get_allocator() == other.get_allocator())
+			set_operation(other, policy, op, sb_tree_balance_joinable<BalancePolicy>());
+		else
+			set_operation(other, policy, op, std::false_type());
+		other.header->parent = nullptr;
+		other.header->left = other.header;
+		other.header->right = other.header;
+		if (header->parent)
+		{
+			header->parent->parent = header;
+			header->left = leftmost(header->parent);
+			header->right = rightmost(header->parent);
+		}
+		else
+		{
+			header->left = header;
+			header->right = header;
+		}
+	}
+
+	// Divide and conquer over split and join, in O(m log(n / m + 1)) work
+	// for trees of m and n elements, m <= n.
+	void set_operation(tree_type& other, const sb_tree_parallel_policy& policy, set_operation_type op, std::true_type)
+	{
+		// every task needs a scratch header for its joins
+		scratch_headers headers(*this);
+		headers.nodes.reserve(policy.threads);
+		while (headers.nodes.size() < policy.threads)
+			headers.nodes.push_back(this->create_node(value_type()));
+		node_pointer a = header->parent;
+		node_pointer b = other.header->parent;
+		switch (op)
+		{
+		case set_union:
+			header->parent = union_subtree(a, b, headers.nodes.data(), policy);
+			break;
+		case set_intersection:
+			header->parent = intersect_subtree(a, b, headers.nodes.data(), policy);
+			break;
+		case set_difference:
+			header->parent = difference_subtree(a, b, headers.nodes.data(), policy);
+			break;
+		}
+	}
+
+	// Destroys the scratch headers of a set operation on every exit.
+	struct scratch_headers
+	{
+		explicit scratch_headers(tree_type& owner) noexcept
+			: tree(owner)
+		{}
+		scratch_headers(const scratch_headers&) = delete;
+		scratch_headers& operator=(const scratch_headers&) = delete;
+		~scratch_headers()
+		{
+			for (node_pointer h : nodes)
+				tree.destroy_node(h);
+		}
+
+		tree_type&                tree;
+		std::vector<node_pointer> nodes;
+	};
+
+	// Balance policies without join merge the sorted sequences and rebuild.
+	// The elements are copied and the result built aside, so both trees are
+	// left as they were when an allocation fails.
+	void set_operation(tree_type& other, const sb_tree_parallel_policy& policy, set_operation_type op, std::false_type)
+	{
+		std::vector<value_type> merged;
+		merged.reserve(op == set_union ? size() + other.size() : size());
+		iterator a = begin();
+		iterator b = other.begin();
+		while (a != end() && b != other.end())
+		{
+			if (comp(*a, *b))
+			{
+				if (op != set_intersection)
+					merged.push_back(*a);
+				++a;
+			}
+			else if (comp(*b, *a))
+			{
+				if (op == set_union)
+					merged.push_back(*b);
+				++b;
+			}
+			else
+			{
+				// keeps or drops the run of equivalent elements of this tree,
+				// and skips the run of other
+				const value_type& key = *b;
+				for (; a != end() && !comp(key, *a); ++a)
+				{
+					if (op != set_difference)
+						merged.push_back(*a);
+				}
+				for (++b; b != other.end() && !comp(key, *b); ++b)
+					;
+			}
+		}
+		for (; a != end() && op != set_intersection; ++a)
+			merged.push_back(*a);
+		for (; b != other.end() && op == set_union; ++b)
+			merged.push_back(*b);
+		tree_type result(comp, this->get_allocator());
+		result.assign_sorted(std::make_move_iterator(merged.begin()), std::make_move_iterator(merged.end()), policy);
+		swap(result);
+		other.clear();
+	}
+
+	// Runs the two halves of a set operation, concurrently when the policy
+	// allows it. Each task uses the first of its scratch headers.
+	template <class Function>
+	inline void set_operation_fork(size_type n, node_pointer* headers, const sb_tree_parallel_policy& policy, Function f)
+	{
+		if (policy.fork(n))
+		{
+			const sb_tree_parallel_policy lhs = policy.left();
+			const sb_tree_parallel_policy rhs = policy.right();
+			sb_tree_fork_join(
+				[&] { f(true, headers + rhs.threads, lhs); },
+				[&] { f(false, headers, rhs); });
+		}
+		else
+		{
+			f(true, headers, policy);
+			f(false, headers, policy);
+		}
+	}
+
+	node_pointer union_subtree(node_pointer a, node_pointer b, node_pointer* headers, const sb_tree_parallel_policy& policy)
+	{
+		if (!a)
+			return b;
+		if (!b)
+			return a;
+		size_type n = a->size + b->size;
+		split_type s = split_subtree(b, NodePolicy::make_probe(a->data), headers[0]);
+		destroy_subtree(s.equal);
+		node_pointer l = a->left;
+		node_pointer r = a->right;
+		set_operation_fork(n, headers, policy, [&](bool left, node_pointer* h, const sb_tree_parallel_policy& p) {
+			if (left)
+				l = union_subtree(l, s.less, h, p);
+			else
+				r = union_subtree(r, s.greater, h, p);
+		});
+		return BalancePolicy::join(headers[0], l, a, r, counters());
+	}
+
+	node_pointer intersect_subtree(node_pointer a, node_pointer b, node_pointer* headers, const sb_tree_parallel_policy& policy)
+	{
+		if (!a || !b)
+		{
+			destroy_subtree(a);
+			destroy_subtree(b);
+			return nullptr;
+		}
+		size_type n = a->size + b->size;
+		split_type s = split_subtree(a, NodePolicy::make_probe(b->data), headers[0]);
+		node_pointer l = b->left;
+		node_pointer r = b->right;
+		this->destroy_node(b);
+		set_operation_fork(n, headers, policy, [&](bool left, node_pointer* h, const sb_tree_parallel_policy& p) {
+			if (left)
+				l = intersect_subtree(s.less, l, h, p);
+			else
+				r = intersect_subtree(s.greater, r, h, p);
+		});
+		return join_subtree(headers[0], join_subtree(headers[0], l, s.equal), r);
+	}
+
+	node_pointer difference_subtree(node_pointer a, node_pointer b, node_pointer* headers, const sb_tree_parallel_policy& policy)
+	{
+		if (!a || !b)
+		{
+			destroy_subtree(b);
+			return a;
+		}
+		size_type n = a->size + b->size;
+		split_type s = split_subtree(a, NodePolicy::make_probe(b->data), headers[0]);
+		destroy_subtree(s.equal);
+		node_pointer l = b->left;
+		node_pointer r = b->right;
+		this->destroy_node(b);
+		set_operation_fork(n, headers, policy, [&](bool left, node_pointer* h, const sb_tree_parallel_policy& p) {
+			if (left)
+				l = difference_subtree(s.less, l, h, p);
+			else
+				r = difference_subtree(s.greater, r, h, p);
+		});
+		return join_subtree(headers[0], l, r);
+	}
+
+	// Splits the t subtree around the key of probe.
+	split_type split_subtree(node_pointer t, const probe_type& probe, node_pointer h)
+	{
+		if (!t)
+			return split_type{ nullptr, nullptr, nullptr };
+		node_pointer l = t->left;
+		node_pointer r = t->right;
+		if (key_less(probe, t))
+		{
+			split_type s = split_subtree(l, probe, h);
+			s.greater = BalancePolicy::join(h, s.greater, t, r, counters());
+			return s;
+		}
+		if (node_less(t, probe))
+		{
+			split_type s = split_subtree(r, probe, h);
+			s.less = BalancePolicy::join(h, l, t, s.less, counters());
+			return s;
+		}
+		// equivalent elements may lie on both sides of t
+		split_type ls = split_subtree(l, probe, h);
+		split_type rs = split_subtree(r, probe, h);
+		return split_type{ ls.less, BalancePolicy::join(h, ls.equal, t, rs.equal, counters()), rs.greater };
+	}
+
+	// Joins two subtrees, every element of l preceding those of r.
+	node_pointer join_subtree(node_pointer h, node_pointer l, node_pointer r)
+	{
+		if (!l)
+			return r;
+		if (!r)
+			return l;
+		node_pointer m;
+		r = split_first(h, r, m);
+		return BalancePolicy::join(h, l, m, r, counters());
+	}
+
+	// Unlinks the first node of the t subtree into m and returns the rest.
+	node_pointer split_first(node_pointer h, node_pointer t, node_pointer& m)
+	{
+		if (!t->left)
+		{
+			m = t;
+			return t->right;
+		}
+		node_pointer rest = split_first(h, t->left, m);
+		return BalancePolicy::join(h, rest, t, t->right, counters());
+	}
+
+	inline node_pointer clone_node(const node_pointer src, const node_pointer parent)
+	{
+		node_pointer n = this->create_node(src->data);
+		NodePolicy::update(n);
+		n->parent = parent;
+		n->left = nullptr;
+		n->right = nullptr;
+		n->size = src->size;
+		return n;
+	}
+
+	// Destroys the t subtree, flattening it by rotations to avoid a stack.
+	void destroy_subtree(node_pointer t)
+	{
+		while (t)
+		{
+			if (t->left)
+			{
+				node_pointer l = t->left;
+				t->left = l->right;
+				l->right = t;
+				t = l;
+			}
+			else
+			{
+				node_pointer r = t->right;
+				this->destroy_node(t);
+				t = r;
+			}
+		}
+	}
+
 	template<class ...Args>
 	node_pointer insert_equal_node(Args&&... args)
 	{
 		// creates a new node
 		node_pointer n = this->create_node(std::forward<Args>(args)...);
+		NodePolicy::update(n);
 		n->left = nullptr;
 		n->right = nullptr;
 		n->size = 1;
 		// if the tree is not empty
 		if (header->parent)
 		{
+			probe_type probe = NodePolicy::make_probe(n->data);
 			// the initial value is root
 			node_pointer t = header->parent;
-			while (t)
+			counters().count_visit();
+			bool flag = !key_less(probe, t);
+			// finds the insertion position
+			for (node_pointer c = flag ? t->right : t->left; c; c = flag ? t->right : t->left)
 			{
-				// increases the size of nodes
-				++t->size;
-				if (comp(n->data, t->data))
-				{
-					if (t->left)
-						t = t->left;
-					else
-					{
-						// inserts the node
-						n->parent = t;
-						t->left = n;
-						if (t == header->left)
-							header->left = n;
-						do
-						{
-							// rebalance after insertion
-							t = insert_rebalance(t->parent, t == t->parent->right);
-						} while (t->parent != header);
-						t = nullptr;
-					}
-				}
-				else
-				{
-					if (t->right)
-						t = t->right;
-					else
-					{
-						// inserts the node
-						n->parent = t;
-						t->right = n;
-						if (t == header->right)
-							header->right = n;
-						do
-						{
-							// rebalance after insertion
-							t = insert_rebalance(t->parent, t == t->parent->right);
-						} while (t->parent != header);
-						t = nullptr;
-					}
-				}
+				counters().count_visit();
+				t = c;
+				flag = !key_less(probe, t);
 			}
+			// inserts the node
+			attach_node(n, t, flag);
 		}
 		else
 		{
@@ -1251,73 +2394,36 @@ private:
 		// if the tree is not empty
 		if (header->parent)
 		{
+			probe_type probe = NodePolicy::make_probe(val);
 			// the initial value is root
 			node_pointer t = header->parent;
-			while (t)
+			node_pointer c = t;
+			bool flag = false;
+			// finds the insertion position
+			while (c)
 			{
-				if (comp(val, t->data))
-				{
-					if (t->left)
-						t = t->left;
-					else
-					{
-						// creates a new node
-						n = this->create_node(std::forward<value_type>(val));
-						n->left = nullptr;
-						n->right = nullptr;
-						n->size = 1;
-						// inserts the node
-						n->parent = t;
-						t->left = n;
-						if (t == header->left)
-							header->left = n;
-						// increases the size of nodes
-						for (node_pointer p = t; p != header; p = p->parent)
-							++p->size;
-						do
-						{
-							// rebalance after insertion
-							t = insert_rebalance(t->parent, t == t->parent->right);
-						} while (t->parent != header);
-						t = nullptr;
-					}
-				}
-				else
-				{
-					// if it already exists
-					if (!comp(t->data, val))
-						return std::make_pair(t, false);
-					if (t->right)
-						t = t->right;
-					else
-					{
-						// creates a new node
-						n = this->create_node(std::forward<value_type>(val));
-						n->left = nullptr;
-						n->right = nullptr;
-						n->size = 1;
-						// inserts the node
-						n->parent = t;
-						t->right = n;
-						if (t == header->right)
-							header->right = n;
-						// increases the size of nodes
-						for (node_pointer p = t; p != header; p = p->parent)
-							++p->size;
-						do
-						{
-							// rebalance after insertion
-							t = insert_rebalance(t->parent, t == t->parent->right);
-						} while (t->parent != header);
-						t = nullptr;
-					}
-				}
+				counters().count_visit();
+				t = c;
+				flag = !key_less(probe, t);
+				// if it already exists
+				if (flag && !node_less(t, probe))
+					return std::make_pair(t, false);
+				c = flag ? t->right : t->left;
 			}
+			// creates a new node
+			n = this->create_node(std::forward<value_type>(val));
+			NodePolicy::update(n);
+			n->left = nullptr;
+			n->right = nullptr;
+			n->size = 1;
+			// inserts the node
+			attach_node(n, t, flag);
 		}
 		else
 		{
 			// creates a new node
 			n = this->create_node(std::forward<value_type>(val));
+			NodePolicy::update(n);
 			n->left = nullptr;
 			n->right = nullptr;
 			n->size = 1;
@@ -1330,6 +2436,77 @@ private:
 		return std::make_pair(n, true);
 	}
 
+	template<class ...Args>
+	node_pointer insert_equal_hint_node(node_pointer h, Args&&... args)
+	{
+		// creates a new node
+		node_pointer n = this->create_node(std::forward<Args>(args)...);
+		NodePolicy::update(n);
+		n->left = nullptr;
+		n->right = nullptr;
+		n->size = 1;
+		// inserts the node after the elements equal to it
+		insert_before(n, upper_bound_node(h, n->data));
+		return n;
+	}
+
+	template<class ...Args>
+	std::pair<node_pointer, bool> insert_unique_hint_node(node_pointer h, Args&&... args)
+	{
+		value_type val = value_type(std::forward<Args>(args)...);
+		node_pointer pos = lower_bound_node(h, val);
+		// if it already exists
+		if (pos != header && !key_less(NodePolicy::make_probe(val), pos))
+			return std::make_pair(pos, false);
+		// creates a new node
+		node_pointer n = this->create_node(std::forward<value_type>(val));
+		NodePolicy::update(n);
+		n->left = nullptr;
+		n->right = nullptr;
+		n->size = 1;
+		// inserts the node
+		insert_before(n, pos);
+		return std::make_pair(n, true);
+	}
+
+	// Links the new node n immediately before the node pos in order.
+	void insert_before(node_pointer n, node_pointer pos)
+	{
+		if (!header->parent)
+		{
+			n->parent = header;
+			header->parent = n;
+			header->left = n;
+			header->right = n;
+		}
+		else if (pos == header)
+			attach_node(n, header->right, true);
+		else if (!pos->left)
+			attach_node(n, pos, false);
+		else
+			attach_node(n, rightmost(pos->left), true);
+	}
+
+	// Links the leaf n as a child of t (the right child if flag is true) and
+	// restores the sizes and the balance on the path from t to the root.
+	void attach_node(node_pointer n, node_pointer t, bool flag)
+	{
+		n->parent = t;
+		if (flag)
+		{
+			t->right = n;
+			if (t == header->right)
+				header->right = n;
+		}
+		else
+		{
+			t->left = n;
+			if (t == header->left)
+				header->left = n;
+		}
+		BalancePolicy::insert_retrace(header, t, flag, counters());
+	}
+
 	void erase_node(node_pointer t)
 	{
 		bool flag;
@@ -1354,16 +2531,8 @@ private:
 				header->left = x ? leftmost(x) : t->parent;
 			if (t == header->right)
 				header->right = x ? rightmost(x) : t->parent;
-			// reduces the number of nodes
-			for (node_pointer p = t->parent; p != header; p = p->parent)
-				--p->size;
-			if (t != header)
-			{
-				// rebalance after deletion
-				node_pointer p = erase_rebalance(t->parent, flag);
-				while (p != header)
-					p = erase_rebalance(p->parent, p == p->parent->right);
-			}
+			// reduces the number of nodes and rebalance after deletion
+			BalancePolicy::erase_retrace(header, t->parent, flag, x, counters());
 		}
 		// case 2. has two child nodes
 		else
@@ -1373,9 +2542,6 @@ private:
 				x = leftmost(t->right);
 				// the rebalance flag
 				flag = (x == x->parent->right);
-				// reduces the number of nodes
-				for (node_pointer p = x->parent; p != header; p = p->parent)
-					--p->size;
 				// replaces t node with x node and removes t node
 				t->left->parent = x;
 				x->left = t->left;
@@ -1404,9 +2570,6 @@ private:
 				x = rightmost(t->left);
 				// the rebalance flag
 				flag = (x == x->parent->right);
-				// reduces the number of nodes
-				for (node_pointer p = x->parent; p != header; p = p->parent)
-					--p->size;
 				// replaces t node with x node and removes t node
 				t->right->parent = x;
 				x->right = t->right;
@@ -1430,10 +2593,8 @@ private:
 				x->parent = t->parent;
 				x->size = t->size;
 			}
-			// rebalance after deletion
-			node_pointer p = erase_rebalance(parent, flag);
-			while (p != header)
-				p = erase_rebalance(p->parent, p == p->parent->right);
+			// reduces the number of nodes and rebalance after deletion
+			BalancePolicy::erase_retrace(header, parent, flag, x, counters());
 		}
 		// destroy node
 		this->destroy_node(t);
@@ -1462,148 +2623,6 @@ private:
 		} while (cur != header);
 	}
 
-	node_pointer left_rotate(node_pointer t) const noexcept
-	{
-		node_pointer r = t->right;
-		t->right = r->left;
-		if (r->left)
-			r->left->parent = t;
-		r->parent = t->parent;
-		if (t == header->parent)
-			header->parent = r;
-		else if (t == t->parent->left)
-			t->parent->left = r;
-		else
-			t->parent->right = r;
-		r->left = t;
-		r->size = t->size;
-		t->parent = r;
-		t->size = (t->left ? t->left->size : 0) + (t->right ? t->right->size : 0) + 1;
-		return r;
-	}
-
-	node_pointer right_rotate(node_pointer t) const noexcept
-	{
-		node_pointer l = t->left;
-		t->left = l->right;
-		if (l->right)
-			l->right->parent = t;
-		l->parent = t->parent;
-		if (t == header->parent)
-			header->parent = l;
-		else if (t == t->parent->right)
-			t->parent->right = l;
-		else
-			t->parent->left = l;
-		l->right = t;
-		l->size = t->size;
-		t->parent = l;
-		t->size = (t->left ? t->left->size : 0) + (t->right ? t->right->size : 0) + 1;
-		return l;
-	}
-
-	node_pointer insert_rebalance(node_pointer t, bool flag)
-	{
-		if (flag)
-		{
-			if (t->right)
-			{
-				size_type left_size = t->left ? t->left->size : 0;
-				// case 1: size(T.left) < size(T.right.left)
-				if (t->right->left && left_size < t->right->left->size)
-				{
-					t->right = right_rotate(t->right);
-					t = left_rotate(t);
-					t->left = insert_rebalance(t->left, false);
-					t->right = insert_rebalance(t->right, true);
-					t = insert_rebalance(t, true);
-				}
-				// case 2. size(T.left) < size(T.right.right)
-				else if (t->right->right && left_size < t->right->right->size)
-				{
-					t = left_rotate(t);
-					t->left = insert_rebalance(t->left, false);
-					t = insert_rebalance(t, true);
-				}
-			}
-		}
-		else
-		{
-			if (t->left)
-			{
-				size_type right_size = t->right ? t->right->size : 0;
-				// case 3. size(T.right) < size(T.left.right)
-				if (t->left->right && right_size < t->left->right->size)
-				{
-					t->left = left_rotate(t->left);
-					t = right_rotate(t);
-					t->left = insert_rebalance(t->left, false);
-					t->right = insert_rebalance(t->right, true);
-					t = insert_rebalance(t, false);
-				}
-				// case 4. size(T.right) < size(T.left.left)
-				else if (t->left->left && right_size < t->left->left->size)
-				{
-					t = right_rotate(t);
-					t->right = insert_rebalance(t->right, true);
-					t = insert_rebalance(t, false);
-				}
-			}
-		}
-		return t;
-	}
-
-	node_pointer erase_rebalance(node_pointer t, bool flag)
-	{
-		if (!flag)
-		{
-			if (t->right)
-			{
-				size_type left_size = t->left ? t->left->size : 0;
-				// case 1: size(T.left) < size(T.right.left)
-				if (t->right->left && left_size < t->right->left->size)
-				{
-					t->right = right_rotate(t->right);
-					t = left_rotate(t);
-					t->left = erase_rebalance(t->left, true);
-					t->right = erase_rebalance(t->right, false);
-					t = erase_rebalance(t, false);
-				}
-				// case 2. size(T.left) < size(T.right.right)
-				else if (t->right->right && left_size < t->right->right->size)
-				{
-					t = left_rotate(t);
-					t->left = erase_rebalance(t->left, true);
-					t = erase_rebalance(t, false);
-				}
-			}
-		}
-		else
-		{
-			if (t->left)
-			{
-				size_type right_size = t->right ? t->right->size : 0;
-				// case 3. size(T.right) < size(T.left.right)
-				if (t->left->right && right_size < t->left->right->size)
-				{
-					t->left = left_rotate(t->left);
-					t = right_rotate(t);
-					t->left = erase_rebalance(t->left, true);
-					t->right = erase_rebalance(t->right, false);
-					t = erase_rebalance(t, true);
-				}
-				// case 4. size(T.right) < size(T.left.left)
-				else if (t->left->left && right_size < t->left->left->size)
-				{
-					t = right_rotate(t);
-					t->right = erase_rebalance(t->right, false);
-					t = erase_rebalance(t, true);
-				}
-			}
-		}
-		return t;
-	}
-
 private:
 	compare_type comp;
 	node_pointer header;
@@ -0,0 +1,600 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_BALANCE_H__
+#define __RULER_SB_TREE_BALANCE_H__
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// The balance policies operate on the size-augmented sb_tree_node through its
+// parent, left, right and size members. The header node is the parent of the
+// root, and every rotation keeps the sizes of the rotated nodes up to date, so
+// rank and select work the same way whichever policy is chosen.
+//
+// A balance policy provides three static member function templates, whose
+// last argument is the stats policy of the tree (see sb_tree_stats.h); the
+// policy reports its rotations and rebalance cases to it:
+//
+//   insert_retrace(header, t, flag, stats)
+//     called after a new leaf has been linked as a child of t (the right
+//     child if flag is true); the sizes on the path from t to the root have
+//     not been increased yet.
+//
+//   erase_retrace(header, t, flag, x, stats)
+//     called after a node has been unlinked from the subtree of t (from the
+//     right side if flag is true) and replaced by x, which may be null; the
+//     sizes on the path from t to the root have not been reduced yet.
+//
+//   access(header, x, stats)
+//     called when a non-const lookup has found x; self-adjusting policies
+//     may restructure the tree here, the others do nothing.
+//
+// A policy may also provide join(header, l, k, r, stats), which links the
+// subtrees l and r below k, every element of l preceding k and every element
+// of r following it, and returns the balanced root of the result. The header is a
+// scratch node that holds the root while rotating. The join-based set
+// operations of sb_tree use it when sb_tree_balance_joinable is true.
+
+
+// Function template sb_tree_left_rotate
+template <class Node>
+inline Node* sb_tree_left_rotate(Node* header, Node* t) noexcept
+{
+	Node* r = t->right;
+	t->right = r->left;
+	if (r->left)
+		r->left->parent = t;
+	r->parent = t->parent;
+	if (t == header->parent)
+		header->parent = r;
+	else if (t == t->parent->left)
+		t->parent->left = r;
+	else
+		t->parent->right = r;
+	r->left = t;
+	r->size = t->size;
+	t->parent = r;
+	t->size = (t->left ? t->left->size : 0) + (t->right ? t->right->size : 0) + 1;
+	return r;
+}
+
+// Function template sb_tree_right_rotate
+template <class Node>
+inline Node* sb_tree_right_rotate(Node* header, Node* t) noexcept
+{
+	Node* l = t->left;
+	t->left = l->right;
+	if (l->right)
+		l->right->parent = t;
+	l->parent = t->parent;
+	if (t == header->parent)
+		header->parent = l;
+	else if (t == t->parent->right)
+		t->parent->right = l;
+	else
+		t->parent->left = l;
+	l->right = t;
+	l->size = t->size;
+	t->parent = l;
+	t->size = (t->left ? t->left->size : 0) + (t->right ? t->right->size : 0) + 1;
+	return l;
+}
+
+// Function template sb_tree_rotate_up
+// Rotates x above its parent.
+template <class Node>
+inline void sb_tree_rotate_up(Node* header, Node* x) noexcept
+{
+	if (x == x->parent->left)
+		sb_tree_right_rotate(header, x->parent);
+	else
+		sb_tree_left_rotate(header, x->parent);
+}
+
+// The overloads taking a stats policy also count the rotations.
+template <class Node, class Stats>
+inline Node* sb_tree_left_rotate(Node* header, Node* t, const Stats& stats) noexcept
+{
+	stats.count_rotation();
+	return sb_tree_left_rotate(header, t);
+}
+
+template <class Node, class Stats>
+inline Node* sb_tree_right_rotate(Node* header, Node* t, const Stats& stats) noexcept
+{
+	stats.count_rotation();
+	return sb_tree_right_rotate(header, t);
+}
+
+template <class Node, class Stats>
+inline void sb_tree_rotate_up(Node* header, Node* x, const Stats& stats) noexcept
+{
+	stats.count_rotation();
+	sb_tree_rotate_up(header, x);
+}
+
+
+// Class sb_tree_size_balance
+// Size-Balanced Tree: the size of each child is not less than the sizes of
+// its two nephews.
+struct sb_tree_size_balance
+{
+	template <class Node, class Stats>
+	static void insert_retrace(Node* header, Node* t, bool flag, const Stats& stats)
+	{
+		stats.count_retrace(false);
+		while (t != header)
+		{
+			++t->size;
+			t = insert_rebalance(header, t, flag, stats);
+			flag = (t == t->parent->right);
+			t = t->parent;
+		}
+	}
+
+	template <class Node, class Stats>
+	static void erase_retrace(Node* header, Node* t, bool flag, Node*, const Stats& stats)
+	{
+		stats.count_retrace(true);
+		while (t != header)
+		{
+			--t->size;
+			t = erase_rebalance(header, t, flag, stats);
+			flag = (t == t->parent->right);
+			t = t->parent;
+		}
+	}
+
+	template <class Node, class Stats>
+	static inline void access(Node*, Node*, const Stats&) noexcept
+	{}
+
+	// Descends the spine of the side that is too heavy to be a child of k,
+	// then restores the properties on the way back as an insertion would.
+	template <class Node, class Stats>
+	static Node* join(Node* header, Node* l, Node* k, Node* r, const Stats& stats)
+	{
+		size_t left_size = l ? l->size : 0;
+		size_t right_size = r ? r->size : 0;
+		if (l && ((l->left && l->left->size > right_size) || (l->right && l->right->size > right_size)))
+		{
+			Node* c = join(header, l->right, k, r, stats);
+			l->right = c;
+			c->parent = l;
+			l->size = left_size + right_size + 1;
+			l->parent = header;
+			header->parent = l;
+			return insert_rebalance(header, l, true, stats);
+		}
+		if (r && ((r->left && r->left->size > left_size) || (r->right && r->right->size > left_size)))
+		{
+			Node* c = join(header, l, k, r->left, stats);
+			r->left = c;
+			c->parent = r;
+			r->size = left_size + right_size + 1;
+			r->parent = header;
+			header->parent = r;
+			return insert_rebalance(header, r, false, stats);
+		}
+		k->left = l;
+		k->right = r;
+		if (l)
+			l->parent = k;
+		if (r)
+			r->parent = k;
+		k->size = left_size + right_size + 1;
+		return k;
+	}
+
+	template <class Node, class Stats>
+	static Node* insert_rebalance(Node* header, Node* t, bool flag, const Stats& stats)
+	{
+		// the pending subtrees are processed in the same order as the
+		// recursive definition: left child, right child, then the node itself
+		Node* nodes[max_pending];
+		bool flags[max_pending];
+		size_t top = 0;
+		size_t depth = 0;
+		Node* p = t->parent;
+		bool side = (p != header && t == p->right);
+		nodes[top] = t;
+		flags[top++] = flag;
+		while (top)
+		{
+			if (top > depth)
+				depth = top;
+			t = nodes[--top];
+			flag = flags[top];
+			assert(top + 3 <= max_pending);
+			if (flag)
+			{
+				if (t->right)
+				{
+					size_t left_size = t->left ? t->left->size : 0;
+					// case 1: size(T.left) < size(T.right.left)
+					if (t->right->left && left_size < t->right->left->size)
+					{
+						stats.count_case(false, 1);
+						sb_tree_right_rotate(header, t->right, stats);
+						t = sb_tree_left_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = true;
+						nodes[top] = t->right;
+						flags[top++] = true;
+						nodes[top] = t->left;
+						flags[top++] = false;
+					}
+					// case 2. size(T.left) < size(T.right.right)
+					else if (t->right->right && left_size < t->right->right->size)
+					{
+						stats.count_case(false, 2);
+						t = sb_tree_left_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = true;
+						nodes[top] = t->left;
+						flags[top++] = false;
+					}
+				}
+			}
+			else
+			{
+				if (t->left)
+				{
+					size_t right_size = t->right ? t->right->size : 0;
+					// case 3. size(T.right) < size(T.left.right)
+					if (t->left->right && right_size < t->left->right->size)
+					{
+						stats.count_case(false, 3);
+						sb_tree_left_rotate(header, t->left, stats);
+						t = sb_tree_right_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = false;
+						nodes[top] = t->right;
+						flags[top++] = true;
+						nodes[top] = t->left;
+						flags[top++] = false;
+					}
+					// case 4. size(T.right) < size(T.left.left)
+					else if (t->left->left && right_size < t->left->left->size)
+					{
+						stats.count_case(false, 4);
+						t = sb_tree_right_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = false;
+						nodes[top] = t->right;
+						flags[top++] = true;
+					}
+				}
+			}
+		}
+		stats.count_depth(depth);
+		return subtree_root(header, p, side);
+	}
+
+	template <class Node, class Stats>
+	static Node* erase_rebalance(Node* header, Node* t, bool flag, const Stats& stats)
+	{
+		// the pending subtrees are processed in the same order as the
+		// recursive definition: left child, right child, then the node itself
+		Node* nodes[max_pending];
+		bool flags[max_pending];
+		size_t top = 0;
+		size_t depth = 0;
+		Node* p = t->parent;
+		bool side = (p != header && t == p->right);
+		nodes[top] = t;
+		flags[top++] = flag;
+		while (top)
+		{
+			if (top > depth)
+				depth = top;
+			t = nodes[--top];
+			flag = flags[top];
+			assert(top + 3 <= max_pending);
+			if (!flag)
+			{
+				if (t->right)
+				{
+					size_t left_size = t->left ? t->left->size : 0;
+					// case 1: size(T.left) < size(T.right.left)
+					if (t->right->left && left_size < t->right->left->size)
+					{
+						stats.count_case(true, 1);
+						sb_tree_right_rotate(header, t->right, stats);
+						t = sb_tree_left_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = false;
+						nodes[top] = t->right;
+						flags[top++] = false;
+						nodes[top] = t->left;
+						flags[top++] = true;
+					}
+					// case 2. size(T.left) < size(T.right.right)
+					else if (t->right->right && left_size < t->right->right->size)
+					{
+						stats.count_case(true, 2);
+						t = sb_tree_left_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = false;
+						nodes[top] = t->left;
+						flags[top++] = true;
+					}
+				}
+			}
+			else
+			{
+				if (t->left)
+				{
+					size_t right_size = t->right ? t->right->size : 0;
+					// case 3. size(T.right) < size(T.left.right)
+					if (t->left->right && right_size < t->left->right->size)
+					{
+						stats.count_case(true, 3);
+						sb_tree_left_rotate(header, t->left, stats);
+						t = sb_tree_right_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = true;
+						nodes[top] = t->right;
+						flags[top++] = false;
+						nodes[top] = t->left;
+						flags[top++] = true;
+					}
+					// case 4. size(T.right) < size(T.left.left)
+					else if (t->left->left && right_size < t->left->left->size)
+					{
+						stats.count_case(true, 4);
+						t = sb_tree_right_rotate(header, t, stats);
+						nodes[top] = t;
+						flags[top++] = true;
+						nodes[top] = t->right;
+						flags[top++] = false;
+					}
+				}
+			}
+		}
+		stats.count_depth(depth);
+		return subtree_root(header, p, side);
+	}
+
+private:
+	// A step pops one subtree and pushes at most three: the rotated root,
+	// its right child and its left child, which is processed next and lies
+	// one level deeper. So the stack grows by at most two entries per level
+	// of the subtree being rebalanced and holds at most 2h + 1 entries for a
+	// subtree of height h. A Size-Balanced Tree of n nodes has a height
+	// below 1.44 log2(n + 1.5), under 93 for any 64-bit size, hence at most
+	// 187 entries. The subtrees that join rebalances are SBTs joined through
+	// one node on a spine, so their height stays within a level of that
+	// bound. The assertions check it in debug builds.
+	static constexpr size_t max_pending = 256;
+
+	// Returns the root of the subtree whose parent is p, on the side given by flag.
+	template <class Node>
+	static inline Node* subtree_root(Node* header, Node* p, bool flag) noexcept
+	{
+		return p == header ? header->parent : (flag ? p->right : p->left);
+	}
+};
+
+
+// Class template sb_tree_balance_joinable
+// Tells whether a balance policy provides join.
+template <class BalancePolicy>
+struct sb_tree_balance_joinable : std::false_type
+{};
+
+template <>
+struct sb_tree_balance_joinable<sb_tree_size_balance> : std::true_type
+{};
+
+
+// Class template sb_tree_weight_balance
+// Weight-balanced tree BB[alpha]: the weight (size + 1) of each child is at
+// least alpha times the weight of its parent, where alpha is
+// Numerator / Denominator and must lie in [2/11, 1 - sqrt(2)/2].
+template <size_t Numerator = 2, size_t Denominator = 7>
+struct sb_tree_weight_balance
+{
+	static_assert(11 * Numerator >= 2 * Denominator && 1000 * Numerator <= 292 * Denominator,
+		"alpha must lie in [2/11, 1 - sqrt(2)/2].");
+
+	template <class Node, class Stats>
+	static void insert_retrace(Node* header, Node* t, bool, const Stats& stats)
+	{
+		stats.count_retrace(false);
+		while (t != header)
+		{
+			++t->size;
+			t = rebalance(header, t, stats);
+			t = t->parent;
+		}
+	}
+
+	template <class Node, class Stats>
+	static void erase_retrace(Node* header, Node* t, bool, Node*, const Stats& stats)
+	{
+		stats.count_retrace(true);
+		while (t != header)
+		{
+			--t->size;
+			t = rebalance(header, t, stats);
+			t = t->parent;
+		}
+	}
+
+	template <class Node, class Stats>
+	static inline void access(Node*, Node*, const Stats&) noexcept
+	{}
+
+	template <class Node, class Stats>
+	static Node* rebalance(Node* header, Node* t, const Stats& stats)
+	{
+		size_t w = t->size + 1;
+		if (Denominator * weight(t->left) < Numerator * w)
+		{
+			// the right subtree is too heavy
+			Node* r = t->right;
+			if (weight(r->left) * (2 * Denominator - Numerator) > Denominator * weight(r))
+				sb_tree_right_rotate(header, r, stats);
+			t = sb_tree_left_rotate(header, t, stats);
+		}
+		else if (Denominator * weight(t->right) < Numerator * w)
+		{
+			// the left subtree is too heavy
+			Node* l = t->left;
+			if (weight(l->right) * (2 * Denominator - Numerator) > Denominator * weight(l))
+				sb_tree_left_rotate(header, l, stats);
+			t = sb_tree_right_rotate(header, t, stats);
+		}
+		return t;
+	}
+
+private:
+	template <class Node>
+	static inline size_t weight(const Node* t) noexcept
+	{
+		return t ? t->size + 1 : 1;
+	}
+};
+
+
+// Class sb_tree_treap_balance
+// Treap: the nodes are heap-ordered by a priority derived from a hash of
+// their address, so that no extra field is needed in the node.
+struct sb_tree_treap_balance
+{
+	template <class Node, class Stats>
+	static void insert_retrace(Node* header, Node* t, bool flag, const Stats& stats)
+	{
+		stats.count_retrace(false);
+		Node* n = flag ? t->right : t->left;
+		for (Node* p = t; p != header; p = p->parent)
+			++p->size;
+		// rotates the new node up until the heap order holds
+		while (n->parent != header && priority(n->parent) < priority(n))
+			sb_tree_rotate_up(header, n, stats);
+	}
+
+	template <class Node, class Stats>
+	static void erase_retrace(Node* header, Node* t, bool, Node* x, const Stats& stats)
+	{
+		stats.count_retrace(true);
+		for (Node* p = t; p != header; p = p->parent)
+			--p->size;
+		// the replacement node may have taken a position above nodes of
+		// higher priority, so it is rotated down until the heap order holds
+		while (x)
+		{
+			Node* c = x->left;
+			if (x->right && (!c || priority(c) < priority(x->right)))
+				c = x->right;
+			if (!c || priority(c) < priority(x))
+				break;
+			sb_tree_rotate_up(header, c, stats);
+		}
+	}
+
+	template <class Node, class Stats>
+	static inline void access(Node*, Node*, const Stats&) noexcept
+	{}
+
+	template <class Node>
+	static inline uint64_t priority(const Node* t) noexcept
+	{
+		// the finalizer of splitmix64
+		uint64_t z = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(t));
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+};
+
+
+// Class sb_tree_splay_balance
+// Splay tree: the inserted node, the parent of the erased node and the node
+// found by a non-const lookup are moved to the root by splaying. Frequently
+// accessed keys therefore stay near the root, which suits skewed lookups.
+struct sb_tree_splay_balance
+{
+	template <class Node, class Stats>
+	static void insert_retrace(Node* header, Node* t, bool flag, const Stats& stats)
+	{
+		stats.count_retrace(false);
+		Node* n = flag ? t->right : t->left;
+		for (Node* p = t; p != header; p = p->parent)
+			++p->size;
+		splay(header, n, stats);
+	}
+
+	template <class Node, class Stats>
+	static void erase_retrace(Node* header, Node* t, bool, Node*, const Stats& stats)
+	{
+		stats.count_retrace(true);
+		for (Node* p = t; p != header; p = p->parent)
+			--p->size;
+		if (t != header)
+			splay(header, t, stats);
+	}
+
+	template <class Node, class Stats>
+	static inline void access(Node* header, Node* x, const Stats& stats)
+	{
+		splay(header, x, stats);
+	}
+
+	template <class Node, class Stats>
+	static void splay(Node* header, Node* x, const Stats& stats)
+	{
+		while (x->parent != header)
+		{
+			Node* p = x->parent;
+			Node* g = p->parent;
+			// zig
+			if (g == header)
+				sb_tree_rotate_up(header, x, stats);
+			// zig-zig
+			else if ((x == p->left) == (p == g->left))
+			{
+				sb_tree_rotate_up(header, p, stats);
+				sb_tree_rotate_up(header, x, stats);
+			}
+			// zig-zag
+			else
+			{
+				sb_tree_rotate_up(header, x, stats);
+				sb_tree_rotate_up(header, x, stats);
+			}
+		}
+	}
+};
+
+#endif
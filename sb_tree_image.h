@@ -0,0 +1,77 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_IMAGE_H__
+#define __RULER_SB_TREE_IMAGE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Struct sb_tree_image_header
+// The header of a saved sb_tree. It is followed by the elements in order,
+// either as their raw bytes (sb_tree_image_raw) or in the format of the
+// writer given to save, or by the nodes of a mapped image
+// (sb_tree_image_mapped). An operation trace (sb_tree_image_trace) is
+// followed by records up to the end of the stream, and its count is 0.
+// Integers are stored in the byte order of the host, recorded by byte_order.
+struct sb_tree_image_header
+{
+	static constexpr uint32_t current_version = 1;
+	static constexpr uint32_t host_order      = 0x01020304;
+
+	char     magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t flags;
+	uint64_t element_size;
+	uint64_t count;
+
+	inline void init(uint32_t image_flags, uint64_t size, uint64_t n) noexcept
+	{
+		std::memcpy(magic, "SBT\0", 4);
+		version = current_version;
+		byte_order = host_order;
+		flags = image_flags;
+		element_size = size;
+		count = n;
+	}
+
+	inline bool valid(void) const noexcept
+	{
+		return !std::memcmp(magic, "SBT\0", 4) && version == current_version && byte_order == host_order;
+	}
+};
+
+// flags:
+static constexpr uint32_t sb_tree_image_raw    = 0x01;
+static constexpr uint32_t sb_tree_image_mapped = 0x02;
+static constexpr uint32_t sb_tree_image_trace  = 0x04;
+
+#endif
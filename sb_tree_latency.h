@@ -0,0 +1,366 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_LATENCY_H__
+#define __RULER_SB_TREE_LATENCY_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "sb_tree_stats.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Struct sb_tree_latency_clock
+// The time stamp counter on x86, nanoseconds of the steady clock elsewhere.
+struct sb_tree_latency_clock
+{
+	static inline uint64_t now(void) noexcept
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+
+	// Calibrated against the steady clock on the first call, for about 10 ms.
+	static double ns_per_tick(void)
+	{
+		static const double ratio = calibrate();
+		return ratio;
+	}
+
+private:
+	static double calibrate(void)
+	{
+		auto first = std::chrono::steady_clock::now();
+		uint64_t begin = now();
+		while (std::chrono::steady_clock::now() - first < std::chrono::milliseconds(10))
+			;
+		auto last = std::chrono::steady_clock::now();
+		uint64_t end = now();
+		double ns = std::chrono::duration<double, std::nano>(last - first).count();
+		return end > begin ? ns / static_cast<double>(end - begin) : 1.0;
+	}
+};
+
+
+// Class sb_tree_latency_histogram
+// A log-linear histogram of clock ticks in the style of HdrHistogram: values
+// below 64 have their own buckets, and each further power of two is split into
+// 32 buckets, so a value is kept within about 3% of its magnitude. Values
+// from 2^40 ticks up are counted in the last bucket. Each histogram has a
+// single writer; the counters are relaxed atomics, so that another thread can
+// merge it while it is being written.
+class sb_tree_latency_histogram
+{
+public:
+	static constexpr unsigned sub_bits     = 5;
+	static constexpr unsigned max_bits     = 40;
+	static constexpr size_t   bucket_count = size_t(max_bits - sub_bits + 1) << sub_bits;
+
+	sb_tree_latency_histogram(void) noexcept
+	{
+		reset();
+	}
+	sb_tree_latency_histogram(const sb_tree_latency_histogram& other) noexcept
+	{
+		reset();
+		merge(other);
+	}
+
+	sb_tree_latency_histogram& operator=(const sb_tree_latency_histogram& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			merge(other);
+		}
+		return *this;
+	}
+
+	inline void record(uint64_t ticks) noexcept
+	{
+		bump(counts[index(ticks)], 1);
+		bump(total, 1);
+		bump(sum, ticks);
+		if (ticks > load(maximum))
+			maximum.store(ticks, std::memory_order_relaxed);
+	}
+
+	void merge(const sb_tree_latency_histogram& other) noexcept
+	{
+		for (size_t i = 0; i < bucket_count; ++i)
+			bump(counts[i], load(other.counts[i]));
+		bump(total, load(other.total));
+		bump(sum, load(other.sum));
+		if (load(other.maximum) > load(maximum))
+			maximum.store(load(other.maximum), std::memory_order_relaxed);
+	}
+
+	void reset(void) noexcept
+	{
+		for (size_t i = 0; i < bucket_count; ++i)
+			counts[i].store(0, std::memory_order_relaxed);
+		total.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+		maximum.store(0, std::memory_order_relaxed);
+	}
+
+	inline uint64_t count(void) const noexcept
+	{
+		return load(total);
+	}
+
+	inline uint64_t max(void) const noexcept
+	{
+		return load(maximum);
+	}
+
+	inline double mean(void) const noexcept
+	{
+		uint64_t n = count();
+		return n ? static_cast<double>(load(sum)) / n : 0.0;
+	}
+
+	// The highest value of the bucket holding the p-quantile, 0 < p <= 1.
+	uint64_t percentile(double p) const noexcept
+	{
+		uint64_t n = count();
+		if (!n)
+			return 0;
+		uint64_t target = static_cast<uint64_t>(p * n + 0.5);
+		if (target < 1)
+			target = 1;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i)
+		{
+			seen += load(counts[i]);
+			if (seen >= target)
+			{
+				uint64_t upper = highest(i);
+				return upper < max() ? upper : max();
+			}
+		}
+		return max();
+	}
+
+private:
+	using counter = std::atomic<uint64_t>;
+
+	static inline size_t index(uint64_t v) noexcept
+	{
+		const uint64_t limit = (uint64_t(1) << max_bits) - 1;
+		if (v > limit)
+			v = limit;
+		if (v < (uint64_t(2) << sub_bits))
+			return static_cast<size_t>(v);
+		unsigned msb = 0;
+		for (uint64_t x = v; x >>= 1; )
+			++msb;
+		unsigned shift = msb - sub_bits;
+		return (size_t(shift + 1) << sub_bits) + static_cast<size_t>((v >> shift) - (uint64_t(1) << sub_bits));
+	}
+
+	static inline uint64_t highest(size_t i) noexcept
+	{
+		if (i < (size_t(2) << sub_bits))
+			return i;
+		unsigned shift = static_cast<unsigned>(i >> sub_bits) - 1;
+		uint64_t sub = (i & ((size_t(1) << sub_bits) - 1)) + (uint64_t(1) << sub_bits);
+		return ((sub + 1) << shift) - 1;
+	}
+
+	static inline void bump(counter& c, uint64_t n) noexcept
+	{
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	static inline uint64_t load(const counter& c) noexcept
+	{
+		return c.load(std::memory_order_relaxed);
+	}
+
+private:
+	counter counts[bucket_count];
+	counter total;
+	counter sum;
+	counter maximum;
+};
+
+
+// Class sb_tree_latency_timer
+// Records the ticks from its construction to its destruction.
+class sb_tree_latency_timer
+{
+public:
+	explicit sb_tree_latency_timer(sb_tree_latency_histogram* h) noexcept
+		: histogram(h)
+		, begin(h ? sb_tree_latency_clock::now() : 0)
+	{}
+	sb_tree_latency_timer(sb_tree_latency_timer&& other) noexcept
+		: histogram(other.histogram)
+		, begin(other.begin)
+	{
+		other.histogram = nullptr;
+	}
+
+	sb_tree_latency_timer(const sb_tree_latency_timer&) = delete;
+	sb_tree_latency_timer& operator=(const sb_tree_latency_timer&) = delete;
+
+	inline ~sb_tree_latency_timer(void)
+	{
+		if (histogram)
+			histogram->record(sb_tree_latency_clock::now() - begin);
+	}
+
+private:
+	sb_tree_latency_histogram* histogram;
+	uint64_t                   begin;
+};
+
+
+// Class template sb_tree_latency_stats
+// A stats policy that times every public operation into a histogram of the
+// calling thread, so that threads sharing a tree never write to the same
+// histogram. latency(op) merges the histograms of all threads. The other
+// events are passed to Base, for instance sb_tree_counting_stats.
+template <class Base = sb_tree_no_stats>
+class sb_tree_latency_stats : public Base
+{
+public:
+	sb_tree_latency_stats(void)
+		: Base()
+		, id(next_id())
+	{}
+	sb_tree_latency_stats(const sb_tree_latency_stats&)
+		: sb_tree_latency_stats()
+	{}
+
+	sb_tree_latency_stats& operator=(const sb_tree_latency_stats&) noexcept
+	{
+		return *this;
+	}
+
+	inline sb_tree_latency_timer start(sb_tree_op op) const noexcept
+	{
+		histogram_set* set = local();
+		return sb_tree_latency_timer(set ? &set->ops[static_cast<size_t>(op)] : nullptr);
+	}
+
+	sb_tree_latency_histogram latency(sb_tree_op op) const
+	{
+		sb_tree_latency_histogram merged;
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& set : sets)
+			merged.merge(set->ops[static_cast<size_t>(op)]);
+		return merged;
+	}
+
+	void reset(void)
+	{
+		Base::reset();
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& set : sets)
+			for (auto& h : set->ops)
+				h.reset();
+	}
+
+private:
+	struct histogram_set
+	{
+		std::thread::id           owner;
+		sb_tree_latency_histogram ops[sb_tree_op_count];
+	};
+
+	static uint64_t next_id(void) noexcept
+	{
+		static std::atomic<uint64_t> last(0);
+		return ++last;
+	}
+
+	// A thread caches the histograms of the last cache_ways trees it used, so
+	// that alternating between a few trees does not take the mutex; the ids
+	// are never reused, so a destroyed tree is never mistaken for a new one.
+	static constexpr size_t cache_ways = 8;
+
+	struct cache_entry
+	{
+		uint64_t       id;
+		histogram_set* set;
+	};
+
+	histogram_set* local(void) const noexcept
+	{
+		thread_local cache_entry cache[cache_ways] = {};
+		thread_local size_t victim = 0;
+		for (const cache_entry& e : cache)
+			if (e.id == id)
+				return e.set;
+		std::thread::id self = std::this_thread::get_id();
+		histogram_set* found = nullptr;
+		try
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const auto& set : sets)
+				if (set->owner == self)
+					found = set.get();
+			if (!found)
+			{
+				sets.emplace_back(new histogram_set());
+				found = sets.back().get();
+				found->owner = self;
+			}
+		}
+		catch (...)
+		{
+			// the operation goes untimed
+			return nullptr;
+		}
+		cache[victim].id = id;
+		cache[victim].set = found;
+		victim = (victim + 1) % cache_ways;
+		return found;
+	}
+
+private:
+	uint64_t                                            id;
+	mutable std::mutex                                  mutex;
+	mutable std::vector<std::unique_ptr<histogram_set>> sets;
+};
+
+#endif
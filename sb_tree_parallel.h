@@ -0,0 +1,102 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_PARALLEL_H__
+#define __RULER_SB_TREE_PARALLEL_H__
+
+#include <cstddef>
+#include <future>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+// Struct sb_tree_parallel_policy
+// Selects the parallel versions of the bulk operations. They split the work
+// by subtree size and run the two halves of a split as a fork-join pair, so
+// at most threads workers run at once; subtrees of grain elements or fewer
+// are handled sequentially. The allocator must allow concurrent allocation.
+struct sb_tree_parallel_policy
+{
+	explicit sb_tree_parallel_policy(size_t thread_count = std::thread::hardware_concurrency(), size_t grain_size = 16384) noexcept
+		: threads(thread_count ? thread_count : 1)
+		, grain(grain_size ? grain_size : 1)
+	{}
+
+	// Returns the policy for one side of a fork.
+	inline sb_tree_parallel_policy left(void) const noexcept
+	{
+		return sb_tree_parallel_policy(threads / 2, grain);
+	}
+	inline sb_tree_parallel_policy right(void) const noexcept
+	{
+		return sb_tree_parallel_policy(threads - threads / 2, grain);
+	}
+
+	// Tells whether a subtree of n elements is worth splitting.
+	inline bool fork(size_t n) const noexcept
+	{
+		return threads > 1 && n > grain;
+	}
+
+	size_t threads;
+	size_t grain;
+};
+
+// Function template sb_tree_fork_join
+// Runs left on a new thread and right on the calling one, and returns once
+// both have finished. If either throws, the exception is rethrown after the
+// other has finished, the one from right taking precedence. When no thread
+// can be started, left runs on the calling one before right.
+template <class Left, class Right>
+inline void sb_tree_fork_join(Left&& left, Right&& right)
+{
+	std::future<void> task;
+	try
+	{
+		task = std::async(std::launch::async, [&left] { left(); });
+	}
+	catch (const std::system_error&)
+	{
+		left();
+		right();
+		return;
+	}
+	try
+	{
+		right();
+	}
+	catch (...)
+	{
+		task.wait();
+		throw;
+	}
+	task.get();
+}
+
+#endif
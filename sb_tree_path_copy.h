@@ -0,0 +1,379 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_PATH_COPY_H__
+#define __RULER_SB_TREE_PATH_COPY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Class template sb_tree_shared_node
+// A node that may be shared between several versions of a tree. It has no
+// parent pointer, and it is never modified once a version containing it has
+// been published. The stamp records the update that created the node.
+template <class T>
+struct sb_tree_shared_node
+{
+	using node_type          = sb_tree_shared_node<T>;
+	using node_pointer       = node_type*;
+	using const_node_pointer = const node_type*;
+
+	node_pointer               left;
+	node_pointer               right;
+	size_t                     size;
+	uint64_t                   stamp;
+	T                          data;
+};
+
+
+// Class template sb_tree_path_copy
+// Size-Balanced Tree updates by path copying. An update copies the nodes on
+// the path it changes, and the nodes of the rotations it performs, instead of
+// modifying them, so every node reachable from an older root keeps its
+// contents. Nodes created by the current update carry its stamp and are
+// modified in place.
+//
+// The Manager owns the node storage and provides:
+//
+//   node_pointer create(stamp, args...)  creates a new node
+//   node_pointer clone(stamp, node)      copies a node of an older version
+//   void retire(node)                    a node of an older version has been
+//                                        replaced in the version being built
+//   void discard(node)                   a node created by the current update
+//                                        is no longer used
+template <class T, class Compare, class Manager>
+class sb_tree_path_copy
+{
+public:
+	// types:
+
+	using node_type          = sb_tree_shared_node<T>;
+	using node_pointer       = node_type*;
+	using const_node_pointer = const node_type*;
+	using value_type         = T;
+	using size_type          = size_t;
+
+	// construct/copy/destroy:
+
+	sb_tree_path_copy(Manager& mgr, const Compare& compare, uint64_t update_stamp) noexcept
+		: manager(mgr)
+		, comp(compare)
+		, stamp(update_stamp)
+	{}
+
+	// updates:
+
+	template <class ...Args>
+	node_pointer insert_equal(node_pointer t, Args&&... args)
+	{
+		node_pointer n = manager.create(stamp, std::forward<Args>(args)...);
+		n->left = nullptr;
+		n->right = nullptr;
+		n->size = 1;
+		return insert_node(t, n);
+	}
+
+	// Removes one element equivalent to key, which must be present.
+	node_pointer erase(node_pointer t, const value_type& key)
+	{
+		if (comp(key, t->data))
+		{
+			t = fresh(t);
+			--t->size;
+			t->left = erase(t->left, key);
+			return maintain(t, true);
+		}
+		if (comp(t->data, key))
+		{
+			t = fresh(t);
+			--t->size;
+			t->right = erase(t->right, key);
+			return maintain(t, false);
+		}
+		node_pointer x;
+		// case 1. has one child node at most
+		if (!t->left || !t->right)
+			x = t->left ? t->left : t->right;
+		// case 2. has two child nodes
+		else
+		{
+			node_pointer left = t->left;
+			node_pointer right = t->right;
+			bool flag = left->size < right->size;
+			if (flag)
+				right = erase_leftmost(right, x);
+			else
+				left = erase_rightmost(left, x);
+			// replaces t node with x node
+			x = fresh(x);
+			x->left = left;
+			x->right = right;
+			x->size = t->size - 1;
+			x = maintain(x, !flag);
+		}
+		dispose(t);
+		return x;
+	}
+
+	// lookups:
+
+	static const_node_pointer find(const Compare& comp, const_node_pointer t, const value_type& key)
+	{
+		const_node_pointer pre = lower_bound(comp, t, key);
+		if (pre && comp(key, pre->data))
+			pre = nullptr;
+		return pre;
+	}
+
+	static const_node_pointer lower_bound(const Compare& comp, const_node_pointer t, const value_type& key)
+	{
+		const_node_pointer pre = nullptr;
+		while (t)
+		{
+			if (!comp(t->data, key))
+			{
+				pre = t;
+				t = t->left;
+			}
+			else
+				t = t->right;
+		}
+		return pre;
+	}
+
+	static const_node_pointer upper_bound(const Compare& comp, const_node_pointer t, const value_type& key)
+	{
+		const_node_pointer pre = nullptr;
+		while (t)
+		{
+			if (comp(key, t->data))
+			{
+				pre = t;
+				t = t->left;
+			}
+			else
+				t = t->right;
+		}
+		return pre;
+	}
+
+	static const_node_pointer select(const_node_pointer t, size_type k)
+	{
+		while (t)
+		{
+			size_type left_size = t->left ? t->left->size : 0;
+			if (left_size < k)
+			{
+				t = t->right;
+				k -= (left_size + 1);
+			}
+			else if (k < left_size)
+				t = t->left;
+			else
+				return t;
+		}
+		return nullptr;
+	}
+
+	static size_type rank(const Compare& comp, const_node_pointer t, const value_type& key)
+	{
+		size_type rank = 0;
+		const_node_pointer pre = nullptr;
+		while (t)
+		{
+			if (!comp(t->data, key))
+			{
+				pre = t;
+				t = t->left;
+			}
+			else
+			{
+				rank += t->left ? t->left->size + 1 : 1;
+				t = t->right;
+			}
+		}
+		if (!pre || comp(key, pre->data))
+			rank = static_cast<size_type>(-1);
+		return rank;
+	}
+
+private:
+	static inline size_type size(const_node_pointer t) noexcept
+	{
+		return t ? t->size : 0;
+	}
+
+	// Returns a node of the current update holding the contents of t.
+	inline node_pointer fresh(node_pointer t)
+	{
+		if (t->stamp == stamp)
+			return t;
+		node_pointer n = manager.clone(stamp, t);
+		manager.retire(t);
+		return n;
+	}
+
+	inline void dispose(node_pointer t)
+	{
+		if (t->stamp == stamp)
+			manager.discard(t);
+		else
+			manager.retire(t);
+	}
+
+	node_pointer insert_node(node_pointer t, node_pointer n)
+	{
+		if (!t)
+			return n;
+		t = fresh(t);
+		++t->size;
+		if (comp(n->data, t->data))
+		{
+			t->left = insert_node(t->left, n);
+			return maintain(t, false);
+		}
+		t->right = insert_node(t->right, n);
+		return maintain(t, true);
+	}
+
+	// Unlinks the leftmost node of t into x.
+	node_pointer erase_leftmost(node_pointer t, node_pointer& x)
+	{
+		if (!t->left)
+		{
+			x = t;
+			return t->right;
+		}
+		t = fresh(t);
+		--t->size;
+		t->left = erase_leftmost(t->left, x);
+		return maintain(t, true);
+	}
+
+	// Unlinks the rightmost node of t into x.
+	node_pointer erase_rightmost(node_pointer t, node_pointer& x)
+	{
+		if (!t->right)
+		{
+			x = t;
+			return t->left;
+		}
+		t = fresh(t);
+		--t->size;
+		t->right = erase_rightmost(t->right, x);
+		return maintain(t, false);
+	}
+
+	node_pointer left_rotate(node_pointer t)
+	{
+		t = fresh(t);
+		node_pointer r = fresh(t->right);
+		t->right = r->left;
+		r->left = t;
+		r->size = t->size;
+		t->size = size(t->left) + size(t->right) + 1;
+		return r;
+	}
+
+	node_pointer right_rotate(node_pointer t)
+	{
+		t = fresh(t);
+		node_pointer l = fresh(t->left);
+		t->left = l->right;
+		l->right = t;
+		l->size = t->size;
+		t->size = size(t->left) + size(t->right) + 1;
+		return l;
+	}
+
+	// Restores the SBT properties of t when its right subtree may be too
+	// large (flag is true) or its left subtree may be too large (flag is
+	// false). Insertion into the right subtree and deletion from the left
+	// subtree both call it with flag set to true.
+	node_pointer maintain(node_pointer t, bool flag)
+	{
+		if (flag)
+		{
+			if (t->right)
+			{
+				size_type left_size = size(t->left);
+				// case 1: size(T.left) < size(T.right.left)
+				if (t->right->left && left_size < t->right->left->size)
+				{
+					t = fresh(t);
+					t->right = right_rotate(t->right);
+					t = left_rotate(t);
+					t->left = maintain(t->left, false);
+					t->right = maintain(t->right, true);
+					t = maintain(t, true);
+				}
+				// case 2. size(T.left) < size(T.right.right)
+				else if (t->right->right && left_size < t->right->right->size)
+				{
+					t = left_rotate(t);
+					t->left = maintain(t->left, false);
+					t = maintain(t, true);
+				}
+			}
+		}
+		else
+		{
+			if (t->left)
+			{
+				size_type right_size = size(t->right);
+				// case 3. size(T.right) < size(T.left.right)
+				if (t->left->right && right_size < t->left->right->size)
+				{
+					t = fresh(t);
+					t->left = left_rotate(t->left);
+					t = right_rotate(t);
+					t->left = maintain(t->left, false);
+					t->right = maintain(t->right, true);
+					t = maintain(t, false);
+				}
+				// case 4. size(T.right) < size(T.left.left)
+				else if (t->left->left && right_size < t->left->left->size)
+				{
+					t = right_rotate(t);
+					t->right = maintain(t->right, true);
+					t = maintain(t, false);
+				}
+			}
+		}
+		return t;
+	}
+
+private:
+	Manager&       manager;
+	const Compare& comp;
+	uint64_t       stamp;
+};
+
+#endif
@@ -0,0 +1,293 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_STATS_H__
+#define __RULER_SB_TREE_STATS_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A stats policy observes the work done inside a sb_tree. The tree calls
+//
+//   count_comparison()        once per key comparison against a node
+//   count_visit()             once per node a descent steps on
+//   count_rotation()          once per single rotation
+//   count_case(erase, c)      when a rebalance applies case c (1 to 4)
+//   count_retrace(erase)      once per insertion or deletion retraced
+//   count_depth(d)            with the deepest stack of pending subtrees
+//                             reached by a rebalance
+//   count_allocation()        once per node allocated, the header included
+//   count_deallocation()      once per node deallocated
+//   start(op)                 at the beginning of a public operation; the
+//                             returned timer ends the timing when destroyed
+//
+// and stats() returns snapshot(). The members are const, because lookups
+// count through a const tree. sb_tree_latency_stats (sb_tree_latency.h)
+// times the operations.
+
+
+// Enum class sb_tree_op
+// The public operations timed through start().
+enum class sb_tree_op : uint8_t
+{
+	insert_equal,
+	insert_unique,
+	erase,
+	find,
+	lower_bound,
+	upper_bound,
+	rank,
+	select
+};
+
+static constexpr size_t sb_tree_op_count = 8;
+
+
+// Struct sb_tree_no_timer
+// The timer of the policies that do not time; the user-provided destructor
+// keeps an unused timer from being reported as an unused variable.
+struct sb_tree_no_timer
+{
+	inline ~sb_tree_no_timer(void)
+	{}
+};
+
+
+// Struct sb_tree_statistics
+// A snapshot of the counters of a tree.
+struct sb_tree_statistics
+{
+	uint64_t comparisons;
+	uint64_t nodes_visited;
+	uint64_t rotations;
+	uint64_t insert_cases[4];
+	uint64_t erase_cases[4];
+	uint64_t insert_retraces;
+	uint64_t erase_retraces;
+	uint64_t max_rebalance_depth;
+	uint64_t allocations;
+	uint64_t deallocations;
+};
+
+
+// Struct sb_tree_diagnostics
+// The shape and memory of a tree, gathered by sb_tree::diagnostics() in one
+// walk, or in slices. Depths count from 0 at the root. The balance slack of a
+// node is the smallest margin of its Size-Balanced Tree properties, the size
+// of each child minus the larger size of its nephews; a negative slack is a
+// violated property, which the other balance policies allow.
+struct sb_tree_diagnostics
+{
+	size_t                 size;
+	size_t                 height;            // levels, 0 when empty
+	size_t                 optimal_height;    // ceil(log2(size + 1))
+	size_t                 max_depth;
+	double                 average_depth;
+	std::vector<size_t>    depth_histogram;   // nodes per level
+	std::vector<ptrdiff_t> balance_slack;     // smallest slack per level
+	size_t                 node_bytes;        // size * sizeof(node)
+	size_t                 header_bytes;      // the header node and the tree object
+	size_t                 allocator_bytes;   // node and header chunks, estimated
+};
+
+// Function sb_tree_finish_diagnostics
+// Derives the height and the depths from the levels walked.
+inline void sb_tree_finish_diagnostics(sb_tree_diagnostics& d) noexcept
+{
+	size_t nodes = 0;
+	size_t total_depth = 0;
+	for (size_t level = 0; level < d.depth_histogram.size(); ++level)
+	{
+		nodes += d.depth_histogram[level];
+		total_depth += level * d.depth_histogram[level];
+	}
+	d.height = d.depth_histogram.size();
+	d.max_depth = d.height ? d.height - 1 : 0;
+	d.average_depth = nodes ? static_cast<double>(total_depth) / nodes : 0.0;
+}
+
+// Class sb_tree_no_stats
+// Counts nothing; every call compiles away and the class is empty (default).
+struct sb_tree_no_stats
+{
+	inline void count_comparison(void) const noexcept
+	{}
+	inline void count_visit(void) const noexcept
+	{}
+	inline void count_rotation(void) const noexcept
+	{}
+	inline void count_case(bool, size_t) const noexcept
+	{}
+	inline void count_retrace(bool) const noexcept
+	{}
+	inline void count_depth(size_t) const noexcept
+	{}
+	inline void count_allocation(void) const noexcept
+	{}
+	inline void count_deallocation(void) const noexcept
+	{}
+	inline sb_tree_no_timer start(sb_tree_op) const noexcept
+	{
+		return sb_tree_no_timer();
+	}
+
+	inline sb_tree_statistics snapshot(void) const noexcept
+	{
+		return sb_tree_statistics();
+	}
+
+	inline void reset(void) noexcept
+	{}
+};
+
+
+// Class sb_tree_counting_stats
+// Counts every event. The counters are relaxed atomics updated by a load and
+// a store rather than a read-modify-write, so counting costs no locked
+// instruction; readers that share a tree may lose a few counts between them,
+// but never race.
+class sb_tree_counting_stats
+{
+public:
+	sb_tree_counting_stats(void) noexcept
+	{
+		reset();
+	}
+	sb_tree_counting_stats(const sb_tree_counting_stats&) noexcept
+		: sb_tree_counting_stats()
+	{}
+
+	sb_tree_counting_stats& operator=(const sb_tree_counting_stats&) noexcept
+	{
+		return *this;
+	}
+
+	inline void count_comparison(void) const noexcept
+	{
+		bump(comparisons);
+	}
+	inline void count_visit(void) const noexcept
+	{
+		bump(nodes_visited);
+	}
+	inline void count_rotation(void) const noexcept
+	{
+		bump(rotations);
+	}
+	inline void count_case(bool erase, size_t c) const noexcept
+	{
+		bump(erase ? erase_cases[c - 1] : insert_cases[c - 1]);
+	}
+	inline void count_retrace(bool erase) const noexcept
+	{
+		bump(erase ? erase_retraces : insert_retraces);
+	}
+	inline void count_depth(size_t d) const noexcept
+	{
+		if (d > max_rebalance_depth.load(std::memory_order_relaxed))
+			max_rebalance_depth.store(d, std::memory_order_relaxed);
+	}
+	inline void count_allocation(void) const noexcept
+	{
+		bump(allocations);
+	}
+	inline void count_deallocation(void) const noexcept
+	{
+		bump(deallocations);
+	}
+	inline sb_tree_no_timer start(sb_tree_op) const noexcept
+	{
+		return sb_tree_no_timer();
+	}
+
+	sb_tree_statistics snapshot(void) const noexcept
+	{
+		sb_tree_statistics s;
+		s.comparisons = load(comparisons);
+		s.nodes_visited = load(nodes_visited);
+		s.rotations = load(rotations);
+		for (size_t i = 0; i < 4; ++i)
+		{
+			s.insert_cases[i] = load(insert_cases[i]);
+			s.erase_cases[i] = load(erase_cases[i]);
+		}
+		s.insert_retraces = load(insert_retraces);
+		s.erase_retraces = load(erase_retraces);
+		s.max_rebalance_depth = load(max_rebalance_depth);
+		s.allocations = load(allocations);
+		s.deallocations = load(deallocations);
+		return s;
+	}
+
+	void reset(void) noexcept
+	{
+		comparisons = 0;
+		nodes_visited = 0;
+		rotations = 0;
+		for (size_t i = 0; i < 4; ++i)
+		{
+			insert_cases[i] = 0;
+			erase_cases[i] = 0;
+		}
+		insert_retraces = 0;
+		erase_retraces = 0;
+		max_rebalance_depth = 0;
+		allocations = 0;
+		deallocations = 0;
+	}
+
+private:
+	using counter = std::atomic<uint64_t>;
+
+	static inline void bump(counter& c) noexcept
+	{
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	static inline uint64_t load(const counter& c) noexcept
+	{
+		return c.load(std::memory_order_relaxed);
+	}
+
+private:
+	mutable counter comparisons;
+	mutable counter nodes_visited;
+	mutable counter rotations;
+	mutable counter insert_cases[4];
+	mutable counter erase_cases[4];
+	mutable counter insert_retraces;
+	mutable counter erase_retraces;
+	mutable counter max_rebalance_depth;
+	mutable counter allocations;
+	mutable counter deallocations;
+};
+
+#endif
@@ -0,0 +1,404 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SB_TREE_TRACE_H__
+#define __RULER_SB_TREE_TRACE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "define.h"
+#include "sb_tree_image.h"
+
+// operations:
+enum class sb_tree_trace_op : uint8_t
+{
+	insert_equal = 1,
+	insert_unique,
+	erase,
+	find,
+	lower_bound,
+	upper_bound,
+	rank,
+	select,
+	erase_one,
+	clear
+};
+
+// record flags:
+static constexpr uint8_t sb_tree_trace_hashed = 0x01;
+
+// Struct sb_tree_trace_record
+// One call: the operation, its key (the index for select, 0 for clear) and the
+// size of its result, which is the number of elements inserted or erased, 1
+// when a lookup found an element and 0 otherwise, or the rank (saturated at
+// 2^32 - 1). erase_one erases a single element equivalent to the key, as
+// erasing through an iterator does.
+// Keys that are not integers of at most 8 bytes are stored as their
+// std::hash, flagged by sb_tree_trace_hashed; such keys keep their equality
+// but not their order on replay.
+struct sb_tree_trace_record
+{
+	uint64_t         key;
+	uint32_t         result;
+	sb_tree_trace_op op;
+	uint8_t          flags;
+	uint16_t         reserved;
+};
+
+// Function template sb_tree_trace_key
+template <class T>
+inline uint64_t sb_tree_trace_key(const T& key, uint8_t& flags, std::true_type) noexcept
+{
+	flags = 0;
+	return static_cast<uint64_t>(key);
+}
+
+template <class T>
+inline uint64_t sb_tree_trace_key(const T& key, uint8_t& flags, std::false_type)
+{
+	flags = sb_tree_trace_hashed;
+	return static_cast<uint64_t>(std::hash<T>()(key));
+}
+
+template <class T>
+inline uint64_t sb_tree_trace_key(const T& key, uint8_t& flags)
+{
+	return sb_tree_trace_key(key, flags, std::integral_constant<bool,
+		(std::is_integral<T>::value || std::is_enum<T>::value) && sizeof(T) <= sizeof(uint64_t)>());
+}
+
+
+// Class sb_tree_trace_writer
+// Buffers trace records and writes them to a stream after an image header
+// with the sb_tree_image_trace flag.
+class sb_tree_trace_writer
+{
+public:
+	explicit sb_tree_trace_writer(std::ostream& os, size_t buffer_records = 4096)
+		: out(os)
+		, capacity(buffer_records ? buffer_records : 1)
+	{
+		sb_tree_image_header h;
+		std::memset(static_cast<void*>(&h), 0, sizeof(h));
+		h.init(sb_tree_image_trace, sizeof(sb_tree_trace_record), 0);
+		if (!out.write(reinterpret_cast<const char*>(&h), sizeof(h)))
+			throw std::runtime_error(SBT_IO_FAILED);
+		buffer.reserve(capacity);
+	}
+
+	sb_tree_trace_writer(const sb_tree_trace_writer&) = delete;
+	sb_tree_trace_writer& operator=(const sb_tree_trace_writer&) = delete;
+
+	~sb_tree_trace_writer(void)
+	{
+		try
+		{
+			flush();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	inline void append(sb_tree_trace_op op, uint64_t key, uint8_t flags, uint64_t result)
+	{
+		sb_tree_trace_record r;
+		r.key = key;
+		r.result = result > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(result);
+		r.op = op;
+		r.flags = flags;
+		r.reserved = 0;
+		buffer.push_back(r);
+		if (buffer.size() == capacity)
+			flush();
+	}
+
+	void flush(void)
+	{
+		if (buffer.empty())
+			return;
+		out.write(reinterpret_cast<const char*>(buffer.data()),
+			static_cast<std::streamsize>(buffer.size() * sizeof(sb_tree_trace_record)));
+		buffer.clear();
+		if (!out.flush())
+			throw std::runtime_error(SBT_IO_FAILED);
+	}
+
+private:
+	std::ostream&                     out;
+	size_t                            capacity;
+	std::vector<sb_tree_trace_record> buffer;
+};
+
+
+// Function sb_tree_read_trace
+// Reads every record of a trace.
+inline std::vector<sb_tree_trace_record> sb_tree_read_trace(std::istream& is)
+{
+	sb_tree_image_header h;
+	if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)) || !h.valid() ||
+		!(h.flags & sb_tree_image_trace) || h.element_size != sizeof(sb_tree_trace_record))
+		throw std::runtime_error(SBT_BAD_IMAGE);
+	std::vector<sb_tree_trace_record> records;
+	sb_tree_trace_record r;
+	while (is.read(reinterpret_cast<char*>(&r), sizeof(r)))
+		records.push_back(r);
+	// a torn final record is dropped
+	if (!is.eof())
+		throw std::runtime_error(SBT_IO_FAILED);
+	return records;
+}
+
+
+// Class template traced_sb_tree
+// Records the calls made through it into a trace. Every insertion and erasure
+// is recorded, so that a replay reaches the same states; lookups are sampled,
+// one in sample_period, which keeps the recorder cheap enough to leave on in
+// production. Range insertions and erasures are recorded element by element.
+// tree() gives only const access, so that no modification escapes the trace;
+// the set operations are not forwarded.
+template <class Tree>
+class traced_sb_tree
+{
+public:
+	// types:
+
+	using tree_type      = Tree;
+	using value_type     = typename Tree::value_type;
+	using size_type      = typename Tree::size_type;
+	using iterator       = typename Tree::iterator;
+	using const_iterator = typename Tree::const_iterator;
+
+	// construct/copy/destroy:
+
+	explicit traced_sb_tree(std::ostream& os, size_t sample_period = 1)
+		: writer(os)
+		, period(sample_period ? sample_period : 1)
+		, countdown(1)
+	{}
+
+	// observers:
+
+	inline const tree_type& tree(void) const noexcept
+	{
+		return data;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return data.size();
+	}
+
+	inline void flush(void)
+	{
+		writer.flush();
+	}
+
+	// modifiers:
+
+	template <class... Args>
+	inline iterator emplace_equal(Args&&... args)
+	{
+		iterator itr = data.emplace_equal(std::forward<Args>(args)...);
+		record(sb_tree_trace_op::insert_equal, *itr, 1);
+		return itr;
+	}
+
+	inline iterator insert_equal(const value_type& value)
+	{
+		iterator itr = data.insert_equal(value);
+		record(sb_tree_trace_op::insert_equal, *itr, 1);
+		return itr;
+	}
+	inline iterator insert_equal(value_type&& value)
+	{
+		iterator itr = data.insert_equal(std::forward<value_type>(value));
+		record(sb_tree_trace_op::insert_equal, *itr, 1);
+		return itr;
+	}
+	inline iterator insert_equal(const_iterator hint, const value_type& value)
+	{
+		iterator itr = data.insert_equal(hint, value);
+		record(sb_tree_trace_op::insert_equal, *itr, 1);
+		return itr;
+	}
+	inline iterator insert_equal(const_iterator hint, value_type&& value)
+	{
+		iterator itr = data.insert_equal(hint, std::forward<value_type>(value));
+		record(sb_tree_trace_op::insert_equal, *itr, 1);
+		return itr;
+	}
+	template <class InputIt>
+	inline void insert_equal(InputIt first, InputIt last)
+	{
+		for (; first != last; ++first)
+			insert_equal(*first);
+	}
+
+	template <class... Args>
+	inline std::pair<iterator, bool> emplace_unique(Args&&... args)
+	{
+		std::pair<iterator, bool> result = data.emplace_unique(std::forward<Args>(args)...);
+		record(sb_tree_trace_op::insert_unique, *result.first, result.second);
+		return result;
+	}
+
+	inline std::pair<iterator, bool> insert_unique(const value_type& value)
+	{
+		std::pair<iterator, bool> result = data.insert_unique(value);
+		record(sb_tree_trace_op::insert_unique, *result.first, result.second);
+		return result;
+	}
+	inline std::pair<iterator, bool> insert_unique(value_type&& value)
+	{
+		std::pair<iterator, bool> result = data.insert_unique(std::forward<value_type>(value));
+		record(sb_tree_trace_op::insert_unique, *result.first, result.second);
+		return result;
+	}
+	inline iterator insert_unique(const_iterator hint, const value_type& value)
+	{
+		size_type n = data.size();
+		iterator itr = data.insert_unique(hint, value);
+		record(sb_tree_trace_op::insert_unique, *itr, data.size() - n);
+		return itr;
+	}
+	inline iterator insert_unique(const_iterator hint, value_type&& value)
+	{
+		size_type n = data.size();
+		iterator itr = data.insert_unique(hint, std::forward<value_type>(value));
+		record(sb_tree_trace_op::insert_unique, *itr, data.size() - n);
+		return itr;
+	}
+	template <class InputIt>
+	inline void insert_unique(InputIt first, InputIt last)
+	{
+		for (; first != last; ++first)
+			insert_unique(*first);
+	}
+
+	inline iterator erase(const_iterator pos)
+	{
+		if (pos != data.cend())
+			record(sb_tree_trace_op::erase_one, *pos, 1);
+		return data.erase(pos);
+	}
+	inline iterator erase(const_iterator first, const_iterator last)
+	{
+		while (first != last)
+			erase(first++);
+		return iterator(last.get_pointer());
+	}
+	inline size_type erase(const value_type& key)
+	{
+		size_type n = data.erase(key);
+		record(sb_tree_trace_op::erase, key, n);
+		return n;
+	}
+
+	inline void clear(void)
+	{
+		writer.append(sb_tree_trace_op::clear, 0, 0, data.size());
+		data.clear();
+	}
+
+	// operations:
+
+	inline iterator find(const value_type& key)
+	{
+		iterator itr = data.find(key);
+		if (sampled())
+			record(sb_tree_trace_op::find, key, itr != data.end());
+		return itr;
+	}
+
+	inline iterator lower_bound(const value_type& key)
+	{
+		iterator itr = data.lower_bound(key);
+		if (sampled())
+			record(sb_tree_trace_op::lower_bound, key, itr != data.end());
+		return itr;
+	}
+
+	inline iterator upper_bound(const value_type& key)
+	{
+		iterator itr = data.upper_bound(key);
+		if (sampled())
+			record(sb_tree_trace_op::upper_bound, key, itr != data.end());
+		return itr;
+	}
+
+	inline size_type rank(const value_type& key) const
+	{
+		size_type r = data.rank(key);
+		if (sampled())
+			record(sb_tree_trace_op::rank, key, r);
+		return r;
+	}
+
+	inline iterator select(size_type idx)
+	{
+		iterator itr = data.select(idx);
+		if (sampled())
+			writer.append(sb_tree_trace_op::select, idx, 0, itr != data.end());
+		return itr;
+	}
+
+private:
+	// counts down instead of dividing
+	inline bool sampled(void) const noexcept
+	{
+		if (--countdown)
+			return false;
+		countdown = period;
+		return true;
+	}
+
+	inline void record(sb_tree_trace_op op, const value_type& key, uint64_t result) const
+	{
+		uint8_t flags;
+		uint64_t k = sb_tree_trace_key(key, flags);
+		writer.append(op, k, flags, result);
+	}
+
+private:
+	mutable sb_tree_trace_writer writer;
+	size_t                       period;
+	mutable size_t               countdown;
+	tree_type                    data;
+};
+
+#endif
@@ -0,0 +1,461 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+#pragma once
+
+#ifndef __RULER_SHARDED_SB_TREE_H__
+#define __RULER_SHARDED_SB_TREE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "define.h"
+#include "sb_tree.h"
+
+// Class template sharded_sb_tree
+// Range-partitions the keys into independent sb_tree shards, each guarded by
+// its own lock, so writers to different key ranges proceed in parallel. Shard
+// i holds the keys in [bounds[i - 1], bounds[i]), so equivalent keys always
+// live in the same shard. The size of every shard is kept in a summary that
+// global rank and select scan to find the shard to delegate to.
+//
+// The tree starts with one shard, and a shard that grows past min_split
+// elements is split at its median. Once the shard limit is reached, a shard
+// is split only when it holds more than 1.5 times the average shard size, and
+// the lightest pair of adjacent shards is merged first to make room. The pair
+// is merged only if it holds at most half the shard being split, so that the
+// merged shard is no larger than the halves and no merge undoes a recent
+// split; otherwise the split waits until the shard has grown to twice the
+// pair. Splits and merges rebuild the shards from sorted runs in linear time
+// and hold the layout lock exclusively, every other operation holds it
+// shared.
+//
+// Global rank and select read the summary without locking the other shards,
+// so they are exact when no writer runs concurrently and may be off by the
+// writes in flight otherwise.
+template <class Tree>
+class sharded_sb_tree
+{
+public:
+	// types:
+
+	using tree_type       = Tree;
+	using value_type      = typename Tree::value_type;
+	using size_type       = typename Tree::size_type;
+	using compare_type    = typename Tree::compare_type;
+	using const_iterator  = typename Tree::const_iterator;
+
+	// construct/copy/destroy:
+
+	explicit sharded_sb_tree(size_type max_shards = 16, size_type min_split = 1024, const compare_type& compare = compare_type())
+		: comp(compare)
+		, shard_limit(max_shards ? max_shards : 1)
+		, split_size(min_split ? min_split : 1)
+		, split_hold(0)
+		, total(0)
+	{
+		shards.emplace_back(new shard(comp));
+	}
+
+	sharded_sb_tree(const sharded_sb_tree&) = delete;
+	sharded_sb_tree& operator=(const sharded_sb_tree&) = delete;
+
+	// capacity:
+
+	inline bool empty(void) const noexcept
+	{
+		return size() == 0;
+	}
+
+	inline size_type size(void) const noexcept
+	{
+		return total.load(std::memory_order_relaxed);
+	}
+
+	inline size_type shard_count(void) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		return shards.size();
+	}
+
+	// element access:
+
+	// pos must be less than size().
+	inline value_type operator[](size_type pos) const
+	{
+		value_type value;
+		select(pos, value);
+		return value;
+	}
+
+	inline value_type at(size_type pos) const
+	{
+		value_type value;
+		if (!select(pos, value))
+			throw std::out_of_range(SBT_OUT_OF_RANGE);
+		return value;
+	}
+
+	// operations:
+
+	inline bool contains(const value_type& key) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		const shard& s = *shards[locate(key)];
+		std::shared_lock<std::shared_mutex> lock(s.mutex);
+		return s.tree.find(key) != s.tree.end();
+	}
+
+	inline bool find(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		const shard& s = *shards[locate(key)];
+		std::shared_lock<std::shared_mutex> lock(s.mutex);
+		return copy_if_valid(s.tree, s.tree.find(key), value);
+	}
+
+	bool lower_bound(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		size_type i = locate(key);
+		{
+			const shard& s = *shards[i];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			if (copy_if_valid(s.tree, s.tree.lower_bound(key), value))
+				return true;
+		}
+		return first_after(i, value);
+	}
+
+	bool upper_bound(const value_type& key, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		size_type i = locate(key);
+		{
+			const shard& s = *shards[i];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			if (copy_if_valid(s.tree, s.tree.upper_bound(key), value))
+				return true;
+		}
+		return first_after(i, value);
+	}
+
+	bool select(size_type idx, value_type& value) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		for (const auto& p : shards)
+		{
+			size_type n = p->count.load(std::memory_order_relaxed);
+			if (idx < n)
+			{
+				std::shared_lock<std::shared_mutex> lock(p->mutex);
+				return copy_if_valid(p->tree, p->tree.select(idx), value);
+			}
+			idx -= n;
+		}
+		return false;
+	}
+
+	size_type rank(const value_type& key) const
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		size_type i = locate(key);
+		size_type r;
+		{
+			const shard& s = *shards[i];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			r = s.tree.rank(key);
+		}
+		if (r == static_cast<size_type>(-1))
+			return r;
+		for (size_type j = 0; j < i; ++j)
+			r += shards[j]->count.load(std::memory_order_relaxed);
+		return r;
+	}
+
+	// modifiers:
+
+	inline void insert_equal(const value_type& value)
+	{
+		emplace(false, value);
+	}
+	inline void insert_equal(value_type&& value)
+	{
+		emplace(false, std::forward<value_type>(value));
+	}
+
+	inline bool insert_unique(const value_type& value)
+	{
+		return emplace(true, value);
+	}
+	inline bool insert_unique(value_type&& value)
+	{
+		return emplace(true, std::forward<value_type>(value));
+	}
+
+	size_type erase(const value_type& key)
+	{
+		std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+		shard& s = *shards[locate(key)];
+		std::unique_lock<std::shared_mutex> lock(s.mutex);
+		size_type n = s.tree.erase(key);
+		s.count.store(s.tree.size(), std::memory_order_relaxed);
+		total.fetch_sub(n, std::memory_order_relaxed);
+		return n;
+	}
+
+	void clear(void)
+	{
+		std::unique_lock<std::shared_mutex> layout_lock(layout_mutex);
+		shards.erase(shards.begin() + 1, shards.end());
+		bounds.clear();
+		split_hold = 0;
+		shards.front()->tree.clear();
+		shards.front()->count.store(0, std::memory_order_relaxed);
+		total.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	struct shard
+	{
+		explicit shard(const compare_type& compare)
+			: tree(compare)
+			, count(0)
+		{}
+
+		mutable std::shared_mutex mutex;
+		tree_type                 tree;
+		std::atomic<size_type>    count;
+	};
+
+	// Returns the index of the shard that holds key.
+	inline size_type locate(const value_type& key) const
+	{
+		return std::upper_bound(bounds.begin(), bounds.end(), key, comp) - bounds.begin();
+	}
+
+	static inline bool copy_if_valid(const tree_type& tree, const_iterator pos, value_type& value)
+	{
+		if (pos == tree.end())
+			return false;
+		value = *pos;
+		return true;
+	}
+
+	// Copies the first element of the shards after shard i.
+	bool first_after(size_type i, value_type& value) const
+	{
+		for (++i; i < shards.size(); ++i)
+		{
+			const shard& s = *shards[i];
+			std::shared_lock<std::shared_mutex> lock(s.mutex);
+			if (copy_if_valid(s.tree, s.tree.cbegin(), value))
+				return true;
+		}
+		return false;
+	}
+
+	template <class V>
+	bool emplace(bool unique, V&& value)
+	{
+		bool split_needed;
+		{
+			std::shared_lock<std::shared_mutex> layout_lock(layout_mutex);
+			shard& s = *shards[locate(value)];
+			std::unique_lock<std::shared_mutex> lock(s.mutex);
+			if (unique)
+			{
+				if (!s.tree.insert_unique(std::forward<V>(value)).second)
+					return false;
+			}
+			else
+				s.tree.insert_equal(std::forward<V>(value));
+			s.count.store(s.tree.size(), std::memory_order_relaxed);
+			total.fetch_add(1, std::memory_order_relaxed);
+			split_needed = s.tree.size() > split_hold && skewed(s.tree.size());
+		}
+		if (split_needed)
+			rebalance();
+		return true;
+	}
+
+	// Tells whether a shard of n elements should be split. Requires the
+	// layout lock.
+	inline bool skewed(size_type n) const noexcept
+	{
+		if (n <= split_size)
+			return false;
+		if (shards.size() < shard_limit)
+			return true;
+		// more than 1.5 times the average shard size
+		return 2 * n * shard_limit > 3 * total.load(std::memory_order_relaxed);
+	}
+
+	// Splits the largest shard if it is still skewed.
+	void rebalance(void)
+	{
+		std::unique_lock<std::shared_mutex> layout_lock(layout_mutex);
+		size_type i = 0;
+		for (size_type j = 1; j < shards.size(); ++j)
+		{
+			if (shards[i]->tree.size() < shards[j]->tree.size())
+				i = j;
+		}
+		size_type n = shards[i]->tree.size();
+		if (n <= split_hold || !skewed(n))
+			return;
+		if (split_point(shards[i]->tree) == shards[i]->tree.cend())
+		{
+			// every key of the shard is equivalent, so nothing is merged and
+			// the split waits until the shard has doubled
+			split_hold = 2 * n - 1;
+			return;
+		}
+		if (shards.size() >= shard_limit)
+		{
+			size_type j = lightest_pair(i);
+			if (j == static_cast<size_type>(-1))
+			{
+				// every pair contains shard i, so it is merged with its
+				// lighter neighbor and the two are split evenly
+				j = i;
+				if (i + 1 == shards.size() || (i > 0 && shards[i - 1]->tree.size() < shards[i + 1]->tree.size()))
+					j = i - 1;
+				merge(j);
+				i = j;
+			}
+			else
+			{
+				size_type m = shards[j]->tree.size() + shards[j + 1]->tree.size();
+				if (2 * m > n)
+				{
+					split_hold = 2 * m - 1;
+					return;
+				}
+				merge(j);
+				if (j < i)
+					--i;
+			}
+		}
+		split_hold = 0;
+		split(i);
+	}
+
+	// Returns j such that shards j and j + 1 are the lightest adjacent pair
+	// not containing shard i.
+	size_type lightest_pair(size_type i) const
+	{
+		size_type best = static_cast<size_type>(-1);
+		size_type best_size = 0;
+		for (size_type j = 0; j + 1 < shards.size(); ++j)
+		{
+			if (j == i || j + 1 == i)
+				continue;
+			size_type n = shards[j]->tree.size() + shards[j + 1]->tree.size();
+			if (best == static_cast<size_type>(-1) || n < best_size)
+			{
+				best = j;
+				best_size = n;
+			}
+		}
+		return best;
+	}
+
+	// Moves the elements of shard j + 1 into shard j. The merged tree is
+	// built from copies and installed once complete, so an allocation
+	// failure leaves both shards as they were.
+	void merge(size_type j)
+	{
+		tree_type& lhs = shards[j]->tree;
+		const tree_type& rhs = shards[j + 1]->tree;
+		// all the keys of rhs follow those of lhs
+		std::vector<value_type> elements;
+		elements.reserve(lhs.size() + rhs.size());
+		elements.insert(elements.end(), lhs.cbegin(), lhs.cend());
+		elements.insert(elements.end(), rhs.cbegin(), rhs.cend());
+		tree_type merged(comp);
+		merged.assign_sorted(std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()));
+		lhs.swap(merged);
+		shards[j]->count.store(lhs.size(), std::memory_order_relaxed);
+		shards.erase(shards.begin() + j + 1);
+		bounds.erase(bounds.begin() + j);
+	}
+
+	// Returns the first element of the upper half of t, or end() when every
+	// key of t is equivalent. Equivalent keys must stay in one shard.
+	static const_iterator split_point(const tree_type& t)
+	{
+		const_iterator mid = t.select(t.size() / 2);
+		const_iterator first = t.lower_bound(mid, *mid);
+		if (first == t.begin())
+			first = t.upper_bound(mid, *mid);
+		return first;
+	}
+
+	// Moves the upper half of shard i into a new shard i + 1. Both halves
+	// are built from copies and installed once complete.
+	void split(size_type i)
+	{
+		tree_type& lhs = shards[i]->tree;
+		const tree_type& view = lhs;
+		const_iterator first = split_point(view);
+		if (first == view.end())
+			return;
+		std::unique_ptr<shard> s(new shard(comp));
+		bounds.reserve(bounds.size() + 1);
+		shards.reserve(shards.size() + 1);
+		std::vector<value_type> elements(view.begin(), first);
+		tree_type lower(comp);
+		lower.assign_sorted(std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()));
+		elements.assign(first, view.end());
+		s->tree.assign_sorted(std::make_move_iterator(elements.begin()), std::make_move_iterator(elements.end()));
+		bounds.insert(bounds.begin() + i, *first);
+		lhs.swap(lower);
+		shards[i]->count.store(lhs.size(), std::memory_order_relaxed);
+		s->count.store(s->tree.size(), std::memory_order_relaxed);
+		shards.insert(shards.begin() + i + 1, std::move(s));
+	}
+
+private:
+	mutable std::shared_mutex           layout_mutex;
+	std::vector<std::unique_ptr<shard>> shards;
+	std::vector<value_type>             bounds;
+	compare_type                        comp;
+	size_type                           shard_limit;
+	size_type                           split_size;
+	// no shard is split before it holds more elements
+	size_type                           split_hold;
+	std::atomic<size_type>              total;
+};
+
+#endif
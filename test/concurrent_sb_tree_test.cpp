@@ -0,0 +1,161 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that concurrent_sb_tree drops a batch whose application threw, so
+// that its commands are not queued and applied again by the next flush,
+// that diagnostics walked in slices agree with one walk of the tree, and
+// that the destructor applies the pending writes and swallows a failure.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include "../concurrent_sb_tree.h"
+
+// fails the allocations once the budget is spent; a negative budget never fails
+static long allocation_budget = -1;
+
+template <class T>
+struct failing_allocator
+{
+	using value_type = T;
+
+	template <class U>
+	struct rebind
+	{
+		using other = failing_allocator<U>;
+	};
+
+	failing_allocator(void) noexcept
+	{}
+	template <class U>
+	failing_allocator(const failing_allocator<U>&) noexcept
+	{}
+
+	T* allocate(size_t n)
+	{
+		if (allocation_budget == 0)
+			throw std::bad_alloc();
+		if (allocation_budget > 0)
+			--allocation_budget;
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, size_t n) noexcept
+	{
+		std::allocator<T>().deallocate(p, n);
+	}
+
+	template <class U>
+	bool operator==(const failing_allocator<U>&) const noexcept
+	{
+		return true;
+	}
+	template <class U>
+	bool operator!=(const failing_allocator<U>&) const noexcept
+	{
+		return false;
+	}
+};
+
+using tree_type = sb_tree<int, std::less<int>, failing_allocator<int>>;
+
+int main(void)
+{
+	concurrent_sb_tree<tree_type> t(4);
+
+	// the fourth write fills the batch and applies it; the third node fails
+	allocation_budget = 2;
+	t.insert_equal(1);
+	t.insert_equal(2);
+	t.insert_equal(3);
+	bool thrown = false;
+	try
+	{
+		t.insert_equal(4);
+	}
+	catch (const std::bad_alloc&)
+	{
+		thrown = true;
+	}
+	assert(thrown);
+	assert(t.size() == 2);
+	assert(t.pending() == 0);
+
+	// the failed batch is not applied again
+	allocation_budget = -1;
+	t.insert_equal(5);
+	t.insert_equal(6);
+	t.flush();
+	assert(t.pending() == 0);
+	assert(t.size() == 4);
+	int expected[] = { 1, 2, 5, 6 };
+	t.read([&](const tree_type& tree) {
+		size_t i = 0;
+		for (int v : tree)
+			assert(v == expected[i++]);
+		return 0;
+	});
+	t.insert_equal(7);
+	t.flush();
+	assert(t.size() == 5);
+
+	for (int i = 0; i < 10000; ++i)
+		t.insert_equal(i * 7919 % 10007);
+	t.flush();
+	sb_tree_diagnostics whole = t.read([](const tree_type& tree) { return tree.diagnostics(); });
+	for (size_t slice : { 1, 3, 4096, 100000 })
+	{
+		sb_tree_diagnostics d = t.diagnostics(slice);
+		assert(d.size == whole.size);
+		assert(d.height == whole.height);
+		assert(d.depth_histogram == whole.depth_histogram);
+		assert(d.balance_slack == whole.balance_slack);
+		assert(d.average_depth == whole.average_depth);
+	}
+
+	// the destructor allocates the nodes of the three pending writes
+	{
+		concurrent_sb_tree<tree_type> u(4);
+		allocation_budget = 1000;
+		u.insert_equal(1);
+		u.insert_equal(2);
+		u.insert_equal(3);
+		assert(u.pending() == 3);
+	}
+	assert(allocation_budget == 997);
+	{
+		concurrent_sb_tree<tree_type> u(4);
+		allocation_budget = 0;
+		u.insert_equal(1);
+	}
+	allocation_budget = -1;
+	std::printf("ok\n");
+	return 0;
+}
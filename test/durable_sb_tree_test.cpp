@@ -0,0 +1,221 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks the recovery of durable_sb_tree: a torn or corrupt tail of the log
+// is dropped and later records follow the valid ones, records already
+// covered by a checkpoint are not replayed twice when the log was not
+// emptied, and the records logged after a checkpoint are replayed on top of
+// it. A commit retried after a write cut short by the file size limit, or
+// a log holding the same records twice, replays each record once. POSIX
+// only.
+
+#undef NDEBUG
+#include <sys/resource.h>
+#include <algorithm>
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "../durable_sb_tree.h"
+#include "../sb_tree.h"
+
+using tree_type = durable_sb_tree<sb_tree<long>>;
+
+static std::string read_file(const std::string& path)
+{
+	std::ifstream is(path, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string& path, const std::string& bytes)
+{
+	std::ofstream os(path, std::ios::binary | std::ios::trunc);
+	os.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static std::vector<long> contents(const tree_type& t)
+{
+	return std::vector<long>(t.tree().begin(), t.tree().end());
+}
+
+static std::vector<long> range(long first, long last)
+{
+	std::vector<long> v;
+	for (long i = first; i < last; ++i)
+		v.push_back(i);
+	return v;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/durable_sb_tree_test.XXXXXX";
+	assert(::mkdtemp(dir));
+	const std::string path = std::string(dir) + "/index";
+	const std::string log = path + ".log";
+	const std::string checkpoint = path + ".ckpt";
+
+	// a torn tail and a corrupt record are dropped
+	{
+		tree_type t(path, 16, 0);
+		for (long i = 0; i < 100; ++i)
+			t.insert_equal(i);
+	}
+	std::string bytes = read_file(log);
+	const size_t record_size = bytes.size() / 100;
+	assert(bytes.size() == 100 * record_size);
+	write_file(log, bytes + bytes.substr(0, record_size / 2));
+	{
+		tree_type t(path, 16, 0);
+		assert(contents(t) == range(0, 100));
+		t.insert_equal(100);
+	}
+	{
+		// the record after the torn tail was kept
+		tree_type t(path, 16, 0);
+		assert(contents(t) == range(0, 101));
+	}
+	bytes = read_file(log);
+	bytes[90 * record_size + record_size - 1] ^= 0x5a;
+	write_file(log, bytes);
+	{
+		tree_type t(path, 16, 0);
+		assert(contents(t) == range(0, 90));
+		assert(read_file(log).size() == 90 * record_size);
+	}
+
+	// a crash between the checkpoint and emptying the log
+	bytes = read_file(log);
+	{
+		tree_type t(path, 16, 0);
+		t.checkpoint();
+	}
+	assert(read_file(log).empty());
+	write_file(log, bytes);
+	{
+		tree_type t(path, 16, 0);
+		assert(contents(t) == range(0, 90));
+	}
+
+	// the records after a checkpoint are replayed on top of it
+	{
+		tree_type t(path, 16, 0);
+		for (long i = 90; i < 120; ++i)
+			t.insert_equal(i);
+		t.erase(5);
+		t.checkpoint();
+		for (long i = 120; i < 150; ++i)
+			t.insert_equal(i);
+		t.erase(6);
+		assert(!t.insert_unique(7));
+	}
+	{
+		tree_type t(path, 16, 0);
+		std::vector<long> expected = range(0, 150);
+		expected.erase(expected.begin() + 5, expected.begin() + 7);
+		assert(contents(t) == expected);
+	}
+
+	// automatic checkpoints every 64 records
+	{
+		tree_type t(path, 8, 64);
+		for (long i = 150; i < 1000; ++i)
+			t.insert_equal(i);
+	}
+	assert(read_file(log).size() < 64 * record_size);
+	{
+		tree_type t(path, 8, 64);
+		assert(t.size() == 998);
+	}
+
+	// records written twice, as after a commit whose fsync failed
+	{
+		tree_type t(path, 8, 0);
+		t.checkpoint();
+		for (long i = 0; i < 40; ++i)
+			t.insert_equal(2000 + i);
+	}
+	bytes = read_file(log);
+	write_file(log, bytes + bytes);
+	{
+		tree_type t(path, 8, 0);
+		assert(t.size() == 998 + 40);
+		t.insert_equal(3000);
+	}
+	{
+		tree_type t(path, 8, 0);
+		assert(t.size() == 998 + 41);
+	}
+
+	// a commit cut short by the file size limit, then retried
+	{
+		tree_type t(path, 1000, 0);
+		t.checkpoint();
+		for (long i = 0; i < 10; ++i)
+			t.insert_equal(4000 + i);
+		t.commit();
+		for (long i = 10; i < 20; ++i)
+			t.insert_equal(4000 + i);
+		std::signal(SIGXFSZ, SIG_IGN);
+		struct rlimit saved, limit;
+		assert(!::getrlimit(RLIMIT_FSIZE, &saved));
+		limit = saved;
+		limit.rlim_cur = static_cast<rlim_t>(10 * record_size + record_size * 3 / 2);
+		assert(!::setrlimit(RLIMIT_FSIZE, &limit));
+		bool failed = false;
+		try
+		{
+			t.commit();
+		}
+		catch (const std::runtime_error&)
+		{
+			failed = true;
+		}
+		assert(failed);
+		assert(!::setrlimit(RLIMIT_FSIZE, &saved));
+		assert(read_file(log).size() == 10 * record_size + record_size * 3 / 2);
+		t.commit();
+		assert(read_file(log).size() == 20 * record_size);
+		t.insert_equal(4020);
+	}
+	{
+		tree_type t(path, 1000, 0);
+		assert(t.size() == 998 + 41 + 21);
+		for (long i = 0; i <= 20; ++i)
+			assert(std::count(t.tree().begin(), t.tree().end(), 4000 + i) == 1);
+	}
+
+	std::remove(log.c_str());
+	std::remove(checkpoint.c_str());
+	::rmdir(dir);
+	std::printf("ok\n");
+	return 0;
+}
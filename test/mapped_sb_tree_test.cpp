@@ -0,0 +1,145 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that mapped_sb_tree answers queries on an image written by write(),
+// and that the constructor rejects an image whose nodes do not have that
+// shape, such as a child offset beyond the image or a path deeper than the
+// iterator holds, throwing SBT_BAD_IMAGE instead of reading past it.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../mapped_sb_tree.h"
+
+using tree_type = mapped_sb_tree<long>;
+using node_type = tree_type::node_type;
+
+// An image in storage aligned for its nodes.
+struct image
+{
+	explicit image(const std::string& bytes)
+		: storage(bytes.size() / sizeof(node_type) + 1)
+		, size(bytes.size())
+	{
+		std::memcpy(static_cast<void*>(storage.data()), bytes.data(), bytes.size());
+	}
+
+	inline node_type& node(size_t i)
+	{
+		return reinterpret_cast<node_type*>(reinterpret_cast<char*>(storage.data()) + tree_type::node_offset)[i];
+	}
+
+	std::vector<node_type> storage;
+	size_t                 size;
+};
+
+static std::string write_image(long n)
+{
+	std::vector<long> elements;
+	for (long i = 0; i < n; ++i)
+		elements.push_back(2 * i);
+	std::ostringstream os;
+	tree_type::write(os, elements.begin(), elements.end());
+	return os.str();
+}
+
+static bool rejected(image& im)
+{
+	try
+	{
+		tree_type t(im.storage.data(), im.size);
+	}
+	catch (const std::runtime_error& e)
+	{
+		assert(!std::strcmp(e.what(), SBT_BAD_IMAGE));
+		return true;
+	}
+	return false;
+}
+
+int main(void)
+{
+	for (long n : { 0, 1, 2, 3, 7, 8, 100, 1000, 4097 })
+	{
+		image im(write_image(n));
+		tree_type t(im.storage.data(), im.size);
+		assert(t.size() == static_cast<size_t>(n));
+		long i = 0;
+		for (long x : t)
+			assert(x == 2 * i++);
+		assert(i == n);
+		for (auto it = t.end(); it != t.begin();)
+			assert(*--it == 2 * --i);
+		for (long k = 0; k < n; ++k)
+		{
+			assert(t[static_cast<size_t>(k)] == 2 * k);
+			assert(t.rank(2 * k) == static_cast<size_t>(k));
+			assert(*t.lower_bound(2 * k - 1) == 2 * k);
+			assert(t.find(2 * k + 1) == t.end());
+		}
+	}
+
+	const long n = 1000;
+	image good(write_image(n));
+	// every node but one left as written
+	for (size_t i = 0; i < n; i += 37)
+	{
+		image im = good;
+		im.node(i).left_size = im.node(i).size;
+		assert(rejected(im));
+		im = good;
+		im.node(i).left_size = uint64_t(1) << 40;
+		assert(rejected(im));
+		im = good;
+		++im.node(i).size;
+		assert(rejected(im));
+	}
+	// a chain of n nodes, consistent but 1000 levels deep
+	{
+		image im = good;
+		for (size_t i = 0; i < n; ++i)
+		{
+			im.node(i).size = n - i;
+			im.node(i).left_size = n - i - 1;
+		}
+		assert(rejected(im));
+	}
+	// a count beyond the nodes of the image
+	{
+		image im = good;
+		reinterpret_cast<sb_tree_image_header*>(im.storage.data())->count = n + 1;
+		assert(rejected(im));
+	}
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,152 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that an update of rcu_sb_tree that throws partway through its path
+// copy leaves the published version, and the nodes waiting to be retired,
+// as they were, and frees the nodes it had already created.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include "../rcu_sb_tree.h"
+
+// copies throw once the budget is spent; a negative budget never throws
+static long copy_budget = -1;
+static long live = 0;
+
+struct fragile
+{
+	int value;
+
+	fragile(int v)
+		: value(v)
+	{
+		++live;
+	}
+
+	fragile(const fragile& other)
+		: value(other.value)
+	{
+		if (copy_budget == 0)
+			throw std::runtime_error("copy");
+		if (copy_budget > 0)
+			--copy_budget;
+		++live;
+	}
+
+	fragile& operator=(const fragile&) = default;
+
+	~fragile(void)
+	{
+		--live;
+	}
+
+	bool operator<(const fragile& other) const
+	{
+		return value < other.value;
+	}
+};
+
+using tree_type = rcu_sb_tree<fragile>;
+
+// every element is readable, in order, and nothing else is alive
+static void check(tree_type& t, tree_type::reader& r, int n)
+{
+	t.synchronize();
+	assert(t.size() == (size_t)n);
+	assert(r.size() == (size_t)n);
+	assert(live == n);
+	fragile v(0);
+	for (int i = 0; i < n; ++i)
+	{
+		assert(r.select(i, v));
+		assert(v.value == 2 * i);
+	}
+}
+
+int main(void)
+{
+	{
+		tree_type t;
+		tree_type::reader r = t.make_reader();
+		const int n = 1000;
+		for (int i = 0; i < n; ++i)
+			t.insert_equal(fragile(2 * i));
+		check(t, r, n);
+
+		// an insert and an erase that fail at each copy of their paths
+		size_t failures = 0;
+		for (long budget = 0; budget < 32; ++budget)
+		{
+			copy_budget = budget;
+			try
+			{
+				t.insert_equal(fragile(1001));
+				copy_budget = -1;
+				t.erase(fragile(1001));
+			}
+			catch (const std::runtime_error&)
+			{
+				++failures;
+			}
+			copy_budget = -1;
+			check(t, r, n);
+
+			copy_budget = budget;
+			try
+			{
+				t.erase(fragile(1000));
+				copy_budget = -1;
+				t.insert_equal(fragile(1000));
+			}
+			catch (const std::runtime_error&)
+			{
+				++failures;
+			}
+			copy_budget = -1;
+			check(t, r, n);
+		}
+		assert(failures > 0);
+
+		// updates after the failures publish and reclaim as usual
+		for (int i = 0; i < n; i += 2)
+			t.erase(fragile(2 * i + 2));
+		t.erase(fragile(0));
+		t.synchronize();
+		assert(t.size() == (size_t)n / 2 - 1);
+		assert(live == n / 2 - 1);
+		t.clear();
+		t.synchronize();
+		assert(t.empty());
+		assert(live == 0);
+	}
+	assert(live == 0);
+	std::printf("ok\n");
+	return 0;
+}
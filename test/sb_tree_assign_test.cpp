@@ -0,0 +1,90 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks copy assignment: the target takes the contents of the source in
+// place of its own, with its own nodes, and assigning a tree to itself or
+// an empty tree over a full one behaves.
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include "../sb_tree.h"
+
+static void check(const sb_tree<int>& t, const std::vector<int>& expected)
+{
+	assert(t.size() == expected.size());
+	assert(std::equal(t.begin(), t.end(), expected.begin(), expected.end()));
+	assert(std::equal(t.rbegin(), t.rend(), expected.rbegin(), expected.rend()));
+	for (size_t i = 0; i < expected.size(); ++i)
+		assert(t[i] == expected[i]);
+}
+
+int main(void)
+{
+	for (int n = 0; n <= 100; ++n)
+	{
+		sb_tree<int> source;
+		std::vector<int> expected;
+		for (int i = 0; i < n; ++i)
+		{
+			source.insert_equal((i * 37) % 101);
+			expected.push_back((i * 37) % 101);
+		}
+		std::sort(expected.begin(), expected.end());
+
+		// over a tree of other contents and size
+		sb_tree<int> target;
+		for (int i = 0; i < 50; ++i)
+			target.insert_equal(1000 + i);
+		target = source;
+		check(target, expected);
+		check(source, expected);
+
+		// the copy does not share nodes with the source
+		target.insert_equal(-1);
+		check(source, expected);
+		target.erase(-1);
+
+		// onto itself
+		sb_tree<int>& alias = target;
+		target = alias;
+		check(target, expected);
+
+		// an empty tree over a full one
+		target = sb_tree<int>();
+		sb_tree<int> empty;
+		target = empty;
+		check(target, std::vector<int>());
+		target.insert_equal(7);
+		check(target, std::vector<int>(1, 7));
+	}
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,106 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that load rejects an image whose element count does not match the
+// stream, throwing SBT_BAD_IMAGE instead of allocating for the count.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "../sb_tree.h"
+
+// Loads image into t and returns whether it was rejected as a bad image.
+template <class Load>
+static bool rejected(const std::string& image, Load load)
+{
+	std::istringstream is(image);
+	try
+	{
+		load(is);
+	}
+	catch (const std::runtime_error& e)
+	{
+		assert(!std::strcmp(e.what(), SBT_BAD_IMAGE));
+		return true;
+	}
+	return false;
+}
+
+// Returns image with its element count replaced.
+static std::string with_count(std::string image, uint64_t count)
+{
+	sb_tree_image_header h;
+	std::memcpy(&h, image.data(), sizeof(h));
+	h.count = count;
+	std::memcpy(&image[0], &h, sizeof(h));
+	return image;
+}
+
+int main(void)
+{
+	sb_tree<long> t;
+	for (long i = 0; i < 100000; ++i)
+		t.insert_equal(i);
+
+	std::ostringstream raw;
+	t.save(raw);
+	std::ostringstream formatted;
+	t.save(formatted, [](std::ostream& os, long x) { os << x << ' '; });
+
+	auto load_raw = [](std::istream& is) {
+		sb_tree<long> u;
+		u.load(is);
+		assert(u.size() == 100000 && u.select(99999) != u.end() && *u.select(99999) == 99999);
+	};
+	auto load_formatted = [](std::istream& is) {
+		sb_tree<long> u;
+		u.load(is, [](std::istream& in) { long x = 0; in >> x; return x; });
+		assert(u.size() == 100000);
+	};
+
+	// intact images load
+	assert(!rejected(raw.str(), load_raw));
+	assert(!rejected(formatted.str(), load_formatted));
+
+	// counts beyond the stream, up to the largest ones
+	for (uint64_t count : { uint64_t(100001), uint64_t(1) << 32, uint64_t(1) << 40, uint64_t(1) << 58 })
+	{
+		assert(rejected(with_count(raw.str(), count), load_raw));
+		assert(rejected(with_count(formatted.str(), count), load_formatted));
+	}
+	assert(rejected(with_count(raw.str(), ~uint64_t(0)), load_raw));
+
+	// a torn image
+	assert(rejected(raw.str().substr(0, raw.str().size() - 1), load_raw));
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that iterators decrement through the root: the header and the root
+// both satisfy node->parent->parent == node, and only the header may be
+// stepped back to the largest element.
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <vector>
+#include "../sb_tree.h"
+
+int main(void)
+{
+	for (int n = 0; n <= 200; ++n)
+	{
+		sb_tree<int> t;
+		std::vector<int> expected;
+		for (int i = 0; i < n; ++i)
+		{
+			t.insert_equal((i * 37) % 101);
+			expected.push_back((i * 37) % 101);
+		}
+		std::sort(expected.begin(), expected.end());
+
+		// reverse iteration visits every element once, in reverse order
+		std::vector<int> reversed(t.rbegin(), t.rend());
+		assert(reversed.size() == expected.size());
+		assert(std::equal(reversed.begin(), reversed.end(), expected.rbegin()));
+
+		// stepping back from every position, the root included
+		size_t i = 0;
+		for (auto it = t.begin(); it != t.end(); ++it, ++i)
+		{
+			auto next = it;
+			++next;
+			assert(--next == it);
+		}
+		if (n)
+			assert(*--t.end() == expected.back());
+		const sb_tree<int>& c = t;
+		size_t k = expected.size();
+		for (auto it = c.end(); it != c.begin();)
+			assert(*--it == expected[--k]);
+		assert(k == 0);
+	}
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks sb_tree_latency_histogram: values below 64 have buckets of their
+// own, every value lies in a bucket whose top is within 1/32 above it and
+// maps back to the same bucket, values from 2^40 up share the last bucket,
+// and the percentiles, mean and maximum of a known distribution match, also
+// after a merge.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "../sb_tree_latency.h"
+
+// The highest value of the bucket of v: with v and a larger value recorded,
+// the median is the top of the bucket of v.
+static uint64_t bucket_top(uint64_t v)
+{
+	sb_tree_latency_histogram h;
+	h.record(v);
+	h.record(uint64_t(1) << 50);
+	return h.percentile(0.5);
+}
+
+static void check_bucket(uint64_t v)
+{
+	uint64_t top = bucket_top(v);
+	assert(v <= top);
+	assert(top - v <= v / 32);
+	assert(bucket_top(top) == top);
+	if (top < (uint64_t(1) << 40) - 1)
+		assert(bucket_top(top + 1) > top);
+}
+
+int main(void)
+{
+	for (uint64_t v = 0; v < 64; ++v)
+		assert(bucket_top(v) == v);
+	assert(bucket_top(63) == 63);
+	assert(bucket_top(64) == 65);
+	assert(bucket_top(65) == 65);
+	assert(bucket_top(66) == 67);
+	for (uint64_t v = 0; v < 10000; ++v)
+		check_bucket(v);
+	for (unsigned bit = 6; bit < 40; ++bit)
+	{
+		uint64_t p = uint64_t(1) << bit;
+		check_bucket(p - 1);
+		check_bucket(p);
+		check_bucket(p + 1);
+		check_bucket(p + p / 3);
+	}
+	const uint64_t last = (uint64_t(1) << 40) - 1;
+	assert(bucket_top(uint64_t(1) << 40) == last);
+	assert(bucket_top(last) == last);
+	assert(bucket_top(uint64_t(1) << 45) == last);
+
+	// 1 to 1000 once each
+	sb_tree_latency_histogram low, high, all;
+	for (uint64_t v = 1; v <= 1000; ++v)
+	{
+		(v <= 500 ? low : high).record(v);
+		all.record(v);
+	}
+	sb_tree_latency_histogram merged(low);
+	merged.merge(high);
+	for (const sb_tree_latency_histogram* h : { &all, &merged })
+	{
+		assert(h->count() == 1000);
+		assert(h->max() == 1000);
+		assert(h->mean() == 500.5);
+		assert(h->percentile(0.5) == bucket_top(500));
+		assert(h->percentile(0.9) == bucket_top(900));
+		assert(h->percentile(0.99) == bucket_top(990));
+		assert(h->percentile(0.999) == 1000);
+		assert(h->percentile(1.0) == 1000);
+		assert(h->percentile(0.0001) == 1);
+		for (double p : { 0.1, 0.25, 0.5, 0.75, 0.9, 0.99 })
+		{
+			double exact = p * 1000;
+			double error = (static_cast<double>(h->percentile(p)) - exact) / exact;
+			assert(error >= 0.0 && error <= 1.0 / 32);
+		}
+	}
+	all.reset();
+	assert(all.count() == 0 && all.percentile(0.5) == 0 && all.max() == 0);
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,277 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks merge_union, intersect and difference against a reference on sorted
+// vectors: the join-based paths of the size balance policy, sequential and
+// parallel, keep the Size-Balanced Tree properties and a height within the
+// bound of 1.44 log2(n + 1.5); trees with unequal allocators fall back to
+// copying, so each allocator frees only the nodes it allocated. An allocation
+// that fails leaves both trees as they were.
+
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <new>
+#include <random>
+#include <vector>
+#include "../sb_tree.h"
+
+// nodes allocated and not yet freed, per allocator tag
+static std::map<int, long> live;
+// allocations left before allocate throws, or -1 for no limit
+static long budget = -1;
+
+template <class T>
+struct tagged_allocator
+{
+	using value_type = T;
+
+	template <class U>
+	struct rebind
+	{
+		using other = tagged_allocator<U>;
+	};
+
+	explicit tagged_allocator(int t = 0) noexcept
+		: tag(t)
+	{}
+	template <class U>
+	tagged_allocator(const tagged_allocator<U>& other) noexcept
+		: tag(other.tag)
+	{}
+
+	T* allocate(size_t n)
+	{
+		if (!budget)
+			throw std::bad_alloc();
+		if (budget > 0)
+			--budget;
+		live[tag] += static_cast<long>(n);
+		return std::allocator<T>().allocate(n);
+	}
+
+	void deallocate(T* p, size_t n) noexcept
+	{
+		live[tag] -= static_cast<long>(n);
+		assert(live[tag] >= 0);
+		std::allocator<T>().deallocate(p, n);
+	}
+
+	template <class U>
+	bool operator==(const tagged_allocator<U>& other) const noexcept
+	{
+		return tag == other.tag;
+	}
+	template <class U>
+	bool operator!=(const tagged_allocator<U>& other) const noexcept
+	{
+		return tag != other.tag;
+	}
+
+	int tag;
+};
+
+using tree_type = sb_tree<int, std::less<int>, tagged_allocator<int>>;
+
+enum class set_op
+{
+	union_op,
+	intersection_op,
+	difference_op
+};
+
+// The elements of a whose keys are (or are not) in b, then for a union the
+// elements of b whose keys are not in a.
+static std::vector<int> reference(const std::vector<int>& a, const std::vector<int>& b, set_op op)
+{
+	std::vector<int> result;
+	for (int x : a)
+	{
+		bool in_b = std::binary_search(b.begin(), b.end(), x);
+		if (op == set_op::union_op || in_b == (op == set_op::intersection_op))
+			result.push_back(x);
+	}
+	if (op == set_op::union_op)
+		for (int x : b)
+			if (!std::binary_search(a.begin(), a.end(), x))
+				result.push_back(x);
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+static void check_shape(const tree_type& t)
+{
+	sb_tree_diagnostics d = t.diagnostics();
+	for (ptrdiff_t slack : d.balance_slack)
+		assert(slack >= 0);
+	double bound = 1.44 * std::log2(static_cast<double>(t.size()) + 1.5);
+	assert(static_cast<double>(d.height) <= std::floor(bound));
+}
+
+static std::vector<int> random_keys(std::mt19937& g, size_t n, int range)
+{
+	std::vector<int> keys(n);
+	for (int& k : keys)
+		k = static_cast<int>(g() % static_cast<unsigned>(range));
+	std::sort(keys.begin(), keys.end());
+	return keys;
+}
+
+static void run(const std::vector<int>& a, const std::vector<int>& b, set_op op, int tag_a, int tag_b, size_t threads)
+{
+	tree_type ta((std::less<int>()), tagged_allocator<int>(tag_a));
+	tree_type tb((std::less<int>()), tagged_allocator<int>(tag_b));
+	for (int x : a)
+		ta.insert_equal(x);
+	for (int x : b)
+		tb.insert_equal(x);
+	sb_tree_parallel_policy policy(threads, 256);
+	switch (op)
+	{
+	case set_op::union_op:
+		ta.merge_union(tb, policy);
+		break;
+	case set_op::intersection_op:
+		ta.intersect(tb, policy);
+		break;
+	case set_op::difference_op:
+		ta.difference(tb, policy);
+		break;
+	}
+	assert(tb.empty());
+	assert(std::vector<int>(ta.begin(), ta.end()) == reference(a, b, op));
+	check_shape(ta);
+	// the allocator of b must have got every one of its nodes back, and
+	// the one of a holds exactly the nodes of the result and its header
+	tb.clear();
+	if (tag_a != tag_b)
+	{
+		assert(live[tag_b] == 1);
+		assert(live[tag_a] == static_cast<long>(ta.size()) + 1);
+	}
+}
+
+// Fails the k-th allocation of the operation for every k until it succeeds.
+static void run_failing(const std::vector<int>& a, const std::vector<int>& b, set_op op, int tag_a, int tag_b)
+{
+	for (long k = 0;; ++k)
+	{
+		tree_type ta((std::less<int>()), tagged_allocator<int>(tag_a));
+		tree_type tb((std::less<int>()), tagged_allocator<int>(tag_b));
+		for (int x : a)
+			ta.insert_equal(x);
+		for (int x : b)
+			tb.insert_equal(x);
+		budget = k;
+		try
+		{
+			switch (op)
+			{
+			case set_op::union_op:
+				ta.merge_union(tb);
+				break;
+			case set_op::intersection_op:
+				ta.intersect(tb);
+				break;
+			case set_op::difference_op:
+				ta.difference(tb);
+				break;
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+			budget = -1;
+			assert(std::vector<int>(ta.begin(), ta.end()) == a);
+			assert(std::vector<int>(tb.begin(), tb.end()) == b);
+			assert(std::vector<int>(ta.rbegin(), ta.rend()) == std::vector<int>(a.rbegin(), a.rend()));
+			continue;
+		}
+		budget = -1;
+		assert(tb.empty());
+		assert(std::vector<int>(ta.begin(), ta.end()) == reference(a, b, op));
+		return;
+	}
+}
+
+int main(void)
+{
+	std::mt19937 g(7);
+	const set_op ops[] = { set_op::union_op, set_op::intersection_op, set_op::difference_op };
+	const size_t sizes[][2] = { { 0, 1000 }, { 1000, 0 }, { 1, 50000 }, { 50000, 1 }, { 1000, 50000 },
+		{ 50000, 1000 }, { 30000, 30000 }, { 100000, 100000 } };
+	for (const auto& n : sizes)
+	{
+		for (int range : { 1000, 1000000 })
+		{
+			std::vector<int> a = random_keys(g, n[0], range);
+			std::vector<int> b = random_keys(g, n[1], range);
+			for (set_op op : ops)
+			{
+				run(a, b, op, 1, 1, 1);
+				run(a, b, op, 1, 1, 4);
+				run(a, b, op, 1, 2, 1);
+				assert(live[1] == 0 && live[2] == 0);
+			}
+		}
+	}
+
+	// disjoint ranges, one tree entirely below the other, which joins whole
+	// subtrees of very different heights
+	for (size_t n : { 10, 1000, 100000 })
+	{
+		std::vector<int> low(n), high(3 * n + 7);
+		for (size_t i = 0; i < low.size(); ++i)
+			low[i] = static_cast<int>(i);
+		for (size_t i = 0; i < high.size(); ++i)
+			high[i] = static_cast<int>(n + i);
+		for (set_op op : ops)
+		{
+			run(low, high, op, 1, 1, 1);
+			run(high, low, op, 1, 1, 4);
+		}
+	}
+	assert(live[1] == 0 && live[2] == 0);
+
+	// failed allocations, in the scratch headers of the joins and in the
+	// rebuild of the copying fallback
+	{
+		std::vector<int> a = random_keys(g, 200, 300);
+		std::vector<int> b = random_keys(g, 150, 300);
+		for (set_op op : ops)
+		{
+			run_failing(a, b, op, 1, 1);
+			run_failing(a, b, op, 1, 2);
+		}
+	}
+	assert(live[1] == 0 && live[2] == 0);
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that non-const lookups on a splay tree restructure the tree on
+// misses too, so that repeated misses below a long spine stay cheap.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include "../sb_tree.h"
+#include "../sb_tree_stats.h"
+
+using splay_tree = sb_tree<long, std::less<long>, std::allocator<long>,
+	sb_tree_plain_node_policy<long>, sb_tree_splay_balance, sb_tree_counting_stats>;
+
+static bool is_sorted(const splay_tree& t)
+{
+	long previous = -1;
+	size_t count = 0;
+	for (long v : t)
+	{
+		if (v < previous)
+			return false;
+		previous = v;
+		++count;
+	}
+	return count == t.size();
+}
+
+int main(void)
+{
+	const long n = 100000;
+	splay_tree t;
+	// sorted inserts leave a spine of height n below the root
+	for (long i = 0; i < n; ++i)
+		t.insert_equal(i);
+
+	// the first miss walks the spine and splays its end, halving the depth
+	// of the path; the following misses are cheap
+	t.reset_stats();
+	for (int i = 0; i < 1000; ++i)
+		assert(t.find(-1) == t.end());
+	// the spine once, then a few nodes per miss
+	uint64_t visited = t.stats().nodes_visited;
+	assert(visited < n + 2 * 1000);
+	assert(is_sorted(t));
+
+	// misses past the other end, and between keys
+	t.reset_stats();
+	for (int i = 0; i < 1000; ++i)
+	{
+		assert(t.find(n + i) == t.end());
+		assert(t.lower_bound(n + i) == t.end());
+		assert(t.upper_bound(n) == t.end());
+	}
+	assert(t.stats().nodes_visited < 2 * n);
+
+	// hits still find the right nodes and keep the order
+	for (long i = 0; i < n; i += 997)
+	{
+		assert(*t.find(i) == i);
+		assert(*t.lower_bound(i) == i);
+		assert(t.upper_bound(i) == t.end() || *t.upper_bound(i) == i + 1);
+		assert(*t.find(t.cbegin(), i) == i);
+	}
+	assert(is_sorted(t));
+	assert(t.size() == static_cast<size_t>(n));
+	std::printf("ok\n");
+	return 0;
+}
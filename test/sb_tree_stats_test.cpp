@@ -0,0 +1,95 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks the counters of sb_tree_counting_stats: ascending insertions take
+// only case 2 of the size balance, one rotation each, on all but about
+// log2(n) of them; every node allocated and not yet freed is an element or
+// the header; and reset_stats zeroes the counters.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <random>
+#include "../sb_tree.h"
+
+using tree_type = sb_tree<int, std::less<int>, std::allocator<int>, sb_tree_plain_node_policy<int>,
+	sb_tree_size_balance, sb_tree_counting_stats>;
+
+static void check_nodes(const tree_type& t)
+{
+	sb_tree_statistics s = t.stats();
+	assert(s.allocations - s.deallocations == t.size() + 1);
+}
+
+int main(void)
+{
+	for (int n : { 1, 2, 3, 10, 1000, 100000 })
+	{
+		tree_type t;
+		for (int i = 0; i < n; ++i)
+			t.insert_equal(i);
+		sb_tree_statistics s = t.stats();
+		assert(s.insert_cases[0] == 0 && s.insert_cases[2] == 0 && s.insert_cases[3] == 0);
+		assert(s.rotations == s.insert_cases[1]);
+		int bits = 0;
+		while ((1 << bits) <= n)
+			++bits;
+		assert(s.insert_cases[1] <= static_cast<uint64_t>(n));
+		assert(s.insert_cases[1] + bits >= static_cast<uint64_t>(n));
+		for (int i = 0; i < 4; ++i)
+			assert(s.erase_cases[i] == 0);
+		assert(s.deallocations == 0);
+		check_nodes(t);
+	}
+
+	// random insertions and erasures
+	std::mt19937 g(3);
+	tree_type t;
+	for (int i = 0; i < 50000; ++i)
+	{
+		int key = static_cast<int>(g() % 10000);
+		if (g() % 3)
+			t.insert_equal(key);
+		else
+			t.erase(key);
+		if (i % 997 == 0)
+			check_nodes(t);
+	}
+	check_nodes(t);
+	assert(t.stats().comparisons > 0 && t.stats().nodes_visited > 0);
+	t.clear();
+	check_nodes(t);
+
+	t.reset_stats();
+	sb_tree_statistics s = t.stats();
+	assert(s.comparisons == 0 && s.rotations == 0 && s.allocations == 0 && s.deallocations == 0);
+	for (int i = 0; i < 4; ++i)
+		assert(s.insert_cases[i] == 0 && s.erase_cases[i] == 0);
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks sharded_sb_tree against std::multiset while shards are split and
+// merged: sorted fills, fills alternating between both ends, and a random
+// mix of insertions and erasures, each under several shard limits. A shard
+// whose keys are all equivalent is not split and costs no merge, and an
+// allocation failure while shards are rebuilt loses no element.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <random>
+#include <set>
+#include "../sharded_sb_tree.h"
+
+using tree_type = sharded_sb_tree<sb_tree<int>>;
+
+// allocations left before allocate throws, or -1 for no limit
+static long budget = -1;
+
+template <class T>
+struct failing_allocator : std::allocator<T>
+{
+	template <class U>
+	struct rebind
+	{
+		using other = failing_allocator<U>;
+	};
+
+	failing_allocator(void) noexcept
+	{}
+	template <class U>
+	failing_allocator(const failing_allocator<U>&) noexcept
+	{}
+
+	T* allocate(size_t n)
+	{
+		if (!budget)
+			throw std::bad_alloc();
+		if (budget > 0)
+			--budget;
+		return std::allocator<T>::allocate(n);
+	}
+};
+
+using failing_tree_type = sharded_sb_tree<sb_tree<int, std::less<int>, failing_allocator<int>>>;
+
+static void check(const tree_type& t, const std::multiset<int>& m, size_t max_shards, std::mt19937& g)
+{
+	assert(t.size() == m.size());
+	assert(t.shard_count() <= max_shards);
+	size_t i = 0;
+	int v;
+	for (int x : m)
+	{
+		assert(t.select(i, v));
+		assert(v == x);
+		++i;
+	}
+	assert(!t.select(i, v));
+	for (int q = 0; q < 200; ++q)
+	{
+		int key = static_cast<int>(g() % 70000) - 35000;
+		auto it = m.lower_bound(key);
+		assert(t.lower_bound(key, v) == (it != m.end()));
+		if (it != m.end())
+			assert(v == *it);
+		it = m.upper_bound(key);
+		assert(t.upper_bound(key, v) == (it != m.end()));
+		if (it != m.end())
+			assert(v == *it);
+		size_t r = t.rank(key);
+		if (m.count(key))
+			assert(r == static_cast<size_t>(std::distance(m.begin(), m.lower_bound(key))));
+		else
+			assert(r == static_cast<size_t>(-1));
+	}
+}
+
+int main(void)
+{
+	for (size_t max_shards : { 1, 2, 3, 16 })
+	{
+		std::mt19937 g(static_cast<unsigned>(max_shards));
+		{
+			tree_type t(max_shards, 64);
+			std::multiset<int> m;
+			for (int i = 0; i < 30000; ++i)
+			{
+				t.insert_equal(i);
+				m.insert(i);
+			}
+			check(t, m, max_shards, g);
+		}
+		{
+			tree_type t(max_shards, 64);
+			std::multiset<int> m;
+			for (int i = 0; i < 30000; ++i)
+			{
+				int key = i & 1 ? i : -i;
+				t.insert_equal(key);
+				m.insert(key);
+			}
+			check(t, m, max_shards, g);
+		}
+		{
+			tree_type t(max_shards, 64);
+			std::multiset<int> m;
+			for (int i = 0; i < 60000; ++i)
+			{
+				int key = i < 20000 ? i : static_cast<int>(g() % 30000);
+				if (g() % 4)
+				{
+					t.insert_equal(key);
+					m.insert(key);
+				}
+				else
+					assert(t.erase(key) == m.erase(key));
+				if (i % 4999 == 0)
+					check(t, m, max_shards, g);
+			}
+			check(t, m, max_shards, g);
+			t.clear();
+			assert(t.empty());
+			assert(t.shard_count() == 1);
+		}
+	}
+
+	// a last shard holding only equivalent keys at the shard limit
+	{
+		std::mt19937 g(5);
+		tree_type t(3, 64);
+		std::multiset<int> m;
+		for (int i = 0; i < 1000; ++i)
+		{
+			t.insert_equal(i);
+			m.insert(i);
+		}
+		assert(t.shard_count() == 3);
+		// empties every shard but the first
+		for (int i = 10; i < 1000; ++i)
+		{
+			t.erase(i);
+			m.erase(i);
+		}
+		for (int i = 0; i < 20000; ++i)
+		{
+			t.insert_equal(5000);
+			m.insert(5000);
+		}
+		assert(t.shard_count() == 3);
+		check(t, m, 3, g);
+	}
+
+	// allocation failures while shards are split and merged
+	for (long k = 0; k < 4000; k += 7)
+	{
+		failing_tree_type t(3, 16);
+		std::multiset<int> m;
+		budget = k;
+		try
+		{
+			for (int i = 0; i < 2000; ++i)
+			{
+				int key = (i * 7919) % 1000;
+				m.insert(key);
+				t.insert_equal(key);
+			}
+		}
+		catch (const std::bad_alloc&)
+		{
+		}
+		budget = -1;
+		// the last insertion may or may not have taken place
+		assert(t.size() == m.size() || t.size() + 1 == m.size());
+		size_t i = 0;
+		int v;
+		bool skipped = t.size() == m.size();
+		for (auto it = m.begin(); it != m.end(); ++it)
+		{
+			if (!skipped && t.size() + 1 == m.size() && !(t.select(i, v) && v == *it))
+			{
+				skipped = true;
+				continue;
+			}
+			assert(t.select(i, v));
+			assert(v == *it);
+			++i;
+		}
+		assert(i == t.size());
+	}
+	std::printf("ok\n");
+	return 0;
+}
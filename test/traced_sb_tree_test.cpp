@@ -0,0 +1,111 @@
+/*====================================================================
+BSD 2-Clause License
+
+Copyright (c) 2023, Ruler
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+====================================================================*/
+
+// Checks that every modifier of traced_sb_tree is recorded: replaying the
+// trace into an empty tree gives back the contents of the traced one.
+
+#undef NDEBUG
+#include <cassert>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+#include "../sb_tree.h"
+#include "../sb_tree_trace.h"
+
+using tree_type = sb_tree<long>;
+
+static void replay(tree_type& t, const std::vector<sb_tree_trace_record>& trace)
+{
+	for (const sb_tree_trace_record& r : trace)
+	{
+		long key = static_cast<long>(r.key);
+		switch (r.op)
+		{
+		case sb_tree_trace_op::insert_equal:
+			t.insert_equal(key);
+			break;
+		case sb_tree_trace_op::insert_unique:
+			assert(t.insert_unique(key).second == (r.result != 0));
+			break;
+		case sb_tree_trace_op::erase:
+			assert(t.erase(key) == r.result);
+			break;
+		case sb_tree_trace_op::erase_one:
+			assert(t.find(key) != t.end());
+			t.erase(t.find(key));
+			break;
+		case sb_tree_trace_op::clear:
+			assert(t.size() == r.result);
+			t.clear();
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	std::stringstream trace;
+	std::vector<long> expected;
+	{
+		traced_sb_tree<tree_type> t(trace, 3);
+		for (long i = 0; i < 100; ++i)
+			t.insert_equal(i % 40);
+		t.insert_equal(t.tree().cend(), 1000);
+		t.insert_equal(t.tree().cbegin(), -5L);
+		t.emplace_equal(7);
+		t.emplace_unique(7);
+		t.emplace_unique(2000);
+		t.insert_unique(3000);
+		t.insert_unique(t.tree().cend(), 4000);
+		t.insert_unique(t.tree().cend(), 4000);
+		std::vector<long> more = { 5, 6, 7 };
+		t.insert_equal(more.begin(), more.end());
+		t.insert_unique(more.begin(), more.end());
+		t.erase(t.find(10));
+		t.erase(t.lower_bound(20), t.upper_bound(25));
+		t.erase(30);
+		t.clear();
+		for (long i = 0; i < 50; ++i)
+			t.insert_equal((i * 7) % 23);
+		t.erase(t.lower_bound(5), t.lower_bound(9));
+		t.erase(t.find(22));
+		t.find(3);
+		t.rank(4);
+		t.select(2);
+		expected.assign(t.tree().begin(), t.tree().end());
+		t.flush();
+	}
+	std::vector<sb_tree_trace_record> records = sb_tree_read_trace(trace);
+	tree_type replayed;
+	replay(replayed, records);
+	assert(std::vector<long>(replayed.begin(), replayed.end()) == expected);
+	std::printf("ok\n");
+	return 0;
+}